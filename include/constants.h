@@ -20,6 +20,67 @@
 #define OUTPUT_SIGNATURE             "signature.json"
 #define OUTPUT_HEADER                "header.json"
 
+/* JSON writer (see json.c) */
+#define JSON_BUFFER_SIZE             (256 * 1024)
+#define JSON_MAX_DEPTH               16
+#define JSON_FORMAT_MAX              64
+#define JSON_BASE64_CHUNK            (48 * 1024)    /* multiple of 3 */
+
+/* per-extraction arena block size, room for the JSON buffer and more */
+#define ARENA_BLOCK_SIZE             (JSON_BUFFER_SIZE + (64 * 1024))
+
+/* cpio payload archives (see cpio.c) */
+#define CPIO_MAGIC_SIZE              6
+#define CPIO_NEWC_MAGIC              "070701"
+#define CPIO_CRC_MAGIC               "070702"
+#define CPIO_STRIPPED_MAGIC          "07070X"
+#define CPIO_NEWC_HEADER_SIZE        110
+#define CPIO_STRIPPED_HEADER_SIZE    (CPIO_MAGIC_SIZE + 8)
+#define CPIO_TRAILER                 "TRAILER!!!"
+#define CPIO_NAME_MAX                8192
+#define CPIO_SKIP_SIZE               (64 * 1024)
+
+/* native payload decompression (see decompress.c) */
+#define DECODER_INPUT_SIZE           (256 * 1024)
+#define DECODER_FRAME_MAX            ((size_t) 256 * 1024 * 1024)
+#define DECODER_INFLIGHT_MAX         ((size_t) 1024 * 1024 * 1024)
+#define DECODER_ZSTD_WINDOWLOG_MAX   31
+
+/* parallel gzip decompression (see gunzip.c) */
+#define GZIP_WINDOW_SIZE             32768
+#define GZIP_CHUNK_SIZE              (2 * 1024 * 1024)
+#define GZIP_OUTPUT_MAX              ((size_t) 8 * GZIP_CHUNK_SIZE)
+#define GZIP_SERIAL_OUTPUT           ((size_t) 4 * 1024 * 1024)
+#define GZIP_FAST_BITS               10
+#define GZIP_CHUNK_RESERVE           ((GZIP_WINDOW_SIZE + GZIP_OUTPUT_MAX) * sizeof(uint16_t))
+
+/* room for a formatted modification time in -tv listings */
+#define LIST_TIME_SIZE               64
+
+/* header integer arrays are converted this many elements at a time */
+#define ENTRY_DECODE_BLOCK           512
+
+/* payload writer pipeline */
+#define PIPELINE_MAX_THREADS         4
+#define PIPELINE_DEPTH               8
+
+/* payload directories kept open by the directory tree (see unpack.c) */
+#define DIRTREE_CACHE_SIZE           256
+
+/* payload verification (see sha256.c and verify.c) */
+#define SHA256_BLOCK_SIZE            64
+#define SHA256_DIGEST_SIZE           32
+#define DIGEST_MAX_SIZE              64
+
+/* buckets in the user and group name caches (see owner.c) */
+#define OWNER_HASH_SIZE              64
+
+/* payload I/O buffer sizing (see iosize.c) */
+#define IO_BUFFER_MIN                (64 * 1024)
+#define IO_BUFFER_MAX                (4 * 1024 * 1024)
+#define IO_BUFFER_SCALE              32
+#define IO_BUFFER_MIN_REQUEST        4096
+
 /* RPM lead */
 #define RPMLEAD_SIZE                 96
 
@@ -48,6 +109,8 @@
 #define RPM_SIGNATURE_HLEN_DESC      "header size (bytes)"
 #define RPM_SIGNATURE_MAGIC          0x8EADE801
 #define RPM_SIGNATURE_RESERVED       0
+#define RPM_MAX_INDEX_ENTRIES        0xffff
+#define RPM_MAX_DATA_SIZE            0x0fffffff
 #define RPM_ENTRY_NAME_DESC          "name"
 #define RPM_ENTRY_TAG_DESC           "number"
 #define RPM_ENTRY_TYPE_DESC          "type"
@@ -7,9 +7,11 @@
 #define _TARPM_TARPM_H
 
 #include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <archive.h>
+#include <archive_entry.h>
 #include <rpm/header.h>
-#include <json.h>
 
 #include "constants.h"
 #include "i18n.h"
@@ -19,9 +21,57 @@
 /* init.c */
 int init_librpm(void);
 
+/* package.c */
+struct rpmpkg *open_rpm_package(const char *path);
+void close_rpm_package(struct rpmpkg *pkg);
+
+/* batch.c */
+int extract_package(const char *path, const char *dest, const struct tarpmopts *opts, struct arena *arena);
+size_t extract_batch(char **paths, const size_t npaths, const char *dest, const struct tarpmopts *opts);
+int read_package_list(const char *listfile, char ***paths, size_t *n);
+
+/* convert.c */
+bool archive_format_valid(const char *name);
+size_t convert_packages(char **paths, const size_t npaths, const struct tarpmopts *opts);
+
+/* cpio.c */
+bool cpio_payload(const struct rpmpkg *pkg);
+void cpio_begin(const struct rpmpkg *pkg, struct cpioreader *r);
+int cpio_next(struct cpioreader *r, rpmfiles files, int *fx, size_t *offset, size_t *size);
+void cpio_stream_begin(struct cpiostream *s, struct decoder *dec);
+int cpio_stream_next(struct cpiostream *s, rpmfiles files, int *fx, uint64_t *size);
+ssize_t cpio_stream_read(struct cpiostream *s, void *buf, size_t len);
+
+/* decompress.c */
+struct decoder *decoder_open(const struct rpmpkg *pkg, const unsigned int threads);
+ssize_t decoder_read(struct decoder *d, void *buf, const size_t len);
+size_t decoder_position(const struct decoder *d);
+void decoder_digest(struct decoder *d, struct digest *dg);
+void decoder_close(struct decoder *d);
+
+/* gunzip.c */
+struct gunzip *gunzip_open(const char *path, const uint8_t *data, const size_t len, const unsigned int threads);
+ssize_t gunzip_read(struct gunzip *g, void *buf, const size_t len);
+size_t gunzip_position(const struct gunzip *g);
+void gunzip_close(struct gunzip *g);
+
+/* filter.c */
+struct filter *filter_new(void);
+void filter_include(struct filter *f, const char *pattern);
+void filter_exclude(struct filter *f, const char *pattern);
+void filter_member(struct filter *f, const char *name);
+void filter_compile(struct filter *f);
+void filter_free(struct filter *f);
+bool filter_match(const struct filter *f, const char *path, bool *seen);
+int filter_files(const struct filter *f, rpmfiles files, const char *path, bool **selected, size_t *count);
+
+/* list.c */
+int list_package(const char *path, const struct tarpmopts *opts, struct jsonw *w);
+size_t list_packages(char **paths, const size_t npaths, const struct tarpmopts *opts);
+
 /* rpm.c */
-char *extract_rpm_payload(const char *rpm);
-Header get_rpm_header(const char *pkg);
+int extract_rpm_payload(const struct rpmpkg *pkg, const char *dest, const struct tarpmopts *opts);
+int convert_rpm_payload(const struct rpmpkg *pkg, struct archive *a, const unsigned int pkgno, const struct tarpmopts *opts);
 char *get_rpmtag_str(Header h, rpmTagVal tag);
 const char *get_rpm_header_arch(Header h);
 char *get_nevr(Header h);
@@ -39,45 +89,129 @@ void *xrealloc(void *p, size_t s);
 #ifdef _HAVE_REALLOCARRAY
 void *xreallocarray(void *p, size_t n, size_t s);
 #endif
+struct arena *arena_new(size_t blocksize);
+void *arena_alloc(struct arena *a, size_t s);
+void *arena_realloc(struct arena *a, void *p, size_t old, size_t s);
+char *arena_strdup(struct arena *a, const char *s);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
 
 /* mkdirp.c */
 int mkdirp(const char *path, mode_t mode);
 
 /* unpack.c */
-int unpack_archive(const char *archive, const char *dest, const bool force, const bool verbose);
+struct dirtree *dirtree_new(const int dirfd, const char *const *dirnames, const size_t ndirs, const uint32_t *nfiles);
+void dirtree_free(struct dirtree *tree);
+struct diskw *disk_writer_new(const int dirfd, const struct dirtree *tree, const bool force, const bool owner);
+int disk_write_header(struct diskw *d, struct archive_entry *entry, const long dx);
+int disk_write_data(struct diskw *d, const char *buf, const size_t len);
+int disk_write_range(struct diskw *d, const int srcfd, off_t offset, const size_t len);
+int disk_write_finish(struct diskw *d);
+int disk_writers_close(struct diskw **writers, const unsigned int n);
+
+/* owner.c */
+uid_t lookup_uid(const char *name);
+gid_t lookup_gid(const char *name);
+bool restore_owner(void);
+
+/* iosize.c */
+size_t parse_size(const char *s);
+size_t io_buffer_size(const struct rpmpkg *pkg, const size_t requested);
+
+/* pipeline.c */
+struct pipeline *pipeline_new(const unsigned int nthreads, const size_t chunksize, const int dirfd, const struct dirtree *tree, const bool force, const bool owner);
+void pipeline_begin(struct pipeline *pl, struct archive_entry *entry, const long key, const long dx, const struct filedigest *digest);
+char *pipeline_buffer(struct pipeline *pl, size_t *avail);
+void pipeline_commit(struct pipeline *pl, const size_t len);
+void pipeline_range(struct pipeline *pl, const int srcfd, const off_t offset, const uint8_t *map, const size_t len);
+void pipeline_end(struct pipeline *pl);
+int pipeline_finish(struct pipeline *pl);
 
 /* lead.c */
-int extract_lead(const int fd, const char *output_dir);
+int extract_lead(const struct rpmpkg *pkg, const char *output_dir, const struct tarpmopts *opts, struct arena *arena);
 
 /* signature.c */
-int extract_signature(const int fd, const char *output_dir);
+int extract_signature(const struct rpmpkg *pkg, const char *output_dir, const struct tarpmopts *opts, struct arena *arena);
 
 /* header.c */
-int extract_header(const int fd, const char *output_dir);
+int extract_header(const struct rpmpkg *pkg, const char *output_dir, const struct tarpmopts *opts, struct arena *arena);
 
 /* joinpath.c */
 char *joinpath(const char *path, ...);
 
 /* json.c */
-int write_json_file(struct json_object *data, const char *output_dir, const char *output_file);
-void free_json(struct json_object *data);
+struct jsonw *json_open(struct arena *arena, const char *output_dir, const char *output_file, const bool pretty);
+struct jsonw *json_stream(struct arena *arena, const int fd);
+int json_close(struct jsonw *w);
+void json_end_record(struct jsonw *w);
+void json_begin_object(struct jsonw *w, const char *key);
+void json_end_object(struct jsonw *w);
+void json_begin_array(struct jsonw *w, const char *key);
+void json_end_array(struct jsonw *w);
+void json_string(struct jsonw *w, const char *key, const char *s);
+void json_stringn(struct jsonw *w, const char *key, const char *s, const size_t n);
+void json_uint(struct jsonw *w, const char *key, uint64_t v);
+void json_base64(struct jsonw *w, const char *key, const void *data, const size_t n);
+void json_printf(struct jsonw *w, const char *key, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+char *json_reserve(struct jsonw *w, const size_t n);
+void json_commit(struct jsonw *w, const size_t n);
 
 /* tags.c */
 const char *tag_type(rpmTagType type);
 const char *signature_tag_name(rpmSigTag tag);
-const char *tag_name(rpmTag tag);
+const struct tagdesc *tag_lookup(rpmTagVal tag);
+const char *tag_name(rpmTagVal tag);
+const char *tag_shortname(rpmTagVal tag);
+bool tag_type_valid(rpmTagVal tag, rpmTagType type, uint32_t count);
+
+/* tagtable.c (generated from rpmtag.h by gentags.py) */
+extern const struct tagdesc tag_table[];
+extern const uint16_t tag_index[];
+extern const size_t tag_index_size;
 
 /* read.c */
-struct rpmsigvalues *compute_sigvalues(const struct rpmsignature *sig, const bool signature);
-struct rpmsignature *read_header_signature(const int fd);
-uint32_t *read_header_entries(const int fd, const struct rpmsignature *sig, const uint32_t hlen);
-struct rpmidxentry *read_header_trailer(const struct rpmidxentry *entry, const uint8_t *datastart);
+int open_view(const int fd, struct rpmview *view);
+int view_need(struct rpmview *view, const size_t len);
+void close_view(struct rpmview *view);
+void compute_sigvalues(const struct rpmsignature *sig, const bool signature, struct rpmsigvalues *vals);
+int read_header_signature(struct rpmview *view, const size_t offset, struct rpmsignature *sig);
+int read_lead(struct rpmview *view, struct rpmlead *lead);
+int read_header_section(struct rpmview *view, size_t *offset, struct rpmsection *section, const bool signature);
+void header_section_pointers(const struct rpmview *view, struct rpmsection *section);
+const void *header_section_blob(const struct rpmview *view, const struct rpmsection *section);
+
+/* bswap.c */
+void bswap16_array(uint16_t *dst, const void *src, const size_t n);
+void bswap32_array(uint32_t *dst, const void *src, const size_t n);
+void bswap64_array(uint64_t *dst, const void *src, const size_t n);
+
+/* base64.c */
+size_t base64_encode(char *dst, const void *src, const size_t n);
+size_t base64_length(const size_t n);
+
+/* sha256.c */
+void sha256_init(struct sha256 *ctx);
+void sha256_update(struct sha256 *ctx, const void *data, size_t len);
+void sha256_final(struct sha256 *ctx, uint8_t out[SHA256_DIGEST_SIZE]);
+
+/* verify.c */
+void digest_init(struct digest *d, const int algo);
+void digest_update(struct digest *d, const void *data, const size_t len);
+size_t digest_final(struct digest *d, uint8_t out[DIGEST_MAX_SIZE]);
+int check_file_digest(const char *path, struct digest *d, const struct filedigest *expect);
+int check_header_digest(const struct rpmpkg *pkg);
+void payload_digest_begin(const struct rpmpkg *pkg, struct paydigest *pd);
+void payload_digest_decoder(struct paydigest *pd, struct decoder *dec);
+int payload_digest_fd(const struct rpmpkg *pkg, struct paydigest *pd);
+void payload_digest_update(const struct rpmpkg *pkg, struct paydigest *pd, const size_t pos);
+int payload_digest_end(const struct rpmpkg *pkg, struct paydigest *pd);
+void payload_digest_cancel(struct paydigest *pd);
 
 /* entry.c */
-void add_entry_value(struct json_object *arrayentry, uint8_t *buffer, uint32_t offset, rpmTagType datatype, uint32_t count);
+void add_entry_value(struct jsonw *w, const uint8_t *buffer, const size_t len, uint32_t offset, rpmTagType datatype, uint32_t count);
 
 /* write.c */
-struct json_object *generate_json(const struct rpmsignature *sig, const struct rpmsigvalues *svals);
-struct json_object *generate_json_entries(const struct rpmsignature *sig, const struct rpmsigvalues *svals, struct rpmidxentry *entry, const bool signature);
+void generate_json(struct jsonw *w, const struct rpmsignature *sig, const struct rpmsigvalues *svals);
+void generate_json_entries(struct jsonw *w, const struct rpmsignature *sig, const struct rpmsigvalues *svals, const struct rpmidxentry *entry, const bool signature);
 
 #endif /* _TARPM_TARPM_H */
@@ -40,11 +40,10 @@ struct rpmsignature {
 struct rpmsigvalues {
     uint32_t ilen;
     uint32_t hlen;
-    struct rpmidxentry *estart;
-    struct rpmidxentry *entry;
-    uint8_t *datastart;
+    const struct rpmidxentry *estart;
+    const struct rpmidxentry *entry;
+    const uint8_t *datastart;
     uint32_t padlen;
-    struct rpmsignature pad;
 };
 
 /* the size of the header intro to read from the file */
@@ -57,14 +56,143 @@ struct rpmidxentry {
     uint32_t count;        /* how many data items are stored in this key */
 };
 
-/* A union for data types used when extracting data from the header. */
-union datatypes
-{
-    char c;
-    int8_t i8;
-    int16_t i16;
-    int32_t i32;
-    int64_t i64;
+/*
+ * Read-only view of the leading part of a package.  Regular files
+ * are mapped in place; anything else is read in to a buffer that
+ * grows as the parser asks for more (see view_need()).
+ */
+struct rpmview {
+    int fd;
+    uint8_t *data;
+    size_t len;            /* bytes available at data */
+    size_t size;           /* mapped or allocated size of data */
+    bool mapped;
+};
+
+/*
+ * A "signature" or "header" section of an RPM.  The index entries and
+ * data store are not copied; svals points in to the package view.
+ */
+struct rpmsection {
+    size_t offset;         /* of the section intro in the package */
+    struct rpmsignature sig;
+    struct rpmsigvalues svals;
+};
+
+/*
+ * An opened RPM package.  The file is opened once and the lead,
+ * signature, and header are parsed once.  Everything else works from
+ * this, including payload extraction which begins at payload_offset.
+ */
+struct rpmpkg {
+    char *path;
+    int fd;
+    struct rpmview view;
+    struct rpmlead lead;
+    struct rpmsection signature;
+    struct rpmsection header;
+    Header h;
+    off_t payload_offset;
+};
+
+/*
+ * Options that control extraction, set from the command line.
+ */
+struct tarpmopts {
+    bool verbose;
+    bool metadata_only;    /* stop after the header, never read the payload */
+    bool compact_json;     /* write JSON without whitespace */
+    bool verify;           /* check payload digests while extracting */
+    bool check;            /* verify only, write nothing */
+    bool ndjson;           /* list as newline delimited JSON */
+    const struct filter *filter;  /* members to extract or list, NULL for all */
+    unsigned int jobs;     /* packages extracted at the same time */
+    unsigned int threads;  /* payload writer threads, 0 writes inline */
+    unsigned int decoders; /* payload decompression threads */
+    size_t buffer_size;    /* payload I/O buffer size, 0 sizes automatically */
+    const char *archive;   /* convert to this archive, "-" for stdout */
+    const char *archive_format;   /* container[.codec], NULL by name */
+    int compression_level; /* -1 for the codec's default */
+    unsigned int compressors;     /* archive compression threads */
+};
+
+/*
+ * Uncompressed payload archive read in place from the mapped package,
+ * see cpio.c.  Offsets are from the start of the archive.
+ */
+struct cpioreader {
+    const uint8_t *data;   /* the archive in the package view */
+    size_t base;           /* package offset of the archive */
+    size_t offset;         /* of the next header */
+    size_t end;            /* of the archive */
+};
+
+/*
+ * Decompressed payload archive read as a stream, see cpio.c.  Offsets
+ * are from the start of the archive.
+ */
+struct cpiostream {
+    struct decoder *dec;
+    uint64_t offset;       /* bytes of the archive read so far */
+    uint64_t left;         /* of the current member's data, unread */
+};
+
+/*
+ * Opaque types private to xalloc.c, json.c, pipeline.c, unpack.c,
+ * filter.c, decompress.c, and gunzip.c.
+ */
+struct arena;
+struct jsonw;
+struct pipeline;
+struct diskw;
+struct dirtree;
+struct filter;
+struct decoder;
+struct gunzip;
+
+/* SHA-256 state, see sha256.c. */
+struct sha256 {
+    uint32_t h[8];
+    uint64_t len;          /* bytes hashed so far */
+    uint8_t buf[SHA256_BLOCK_SIZE];
+    size_t n;              /* bytes waiting in buf */
+};
+
+/* Running digest of payload data, see verify.c. */
+struct digest {
+    int algo;              /* PGPHASHALGO_* */
+    struct sha256 sha;
+    DIGEST_CTX ctx;        /* librpm, for anything but SHA-256 */
+};
+
+/* Expected digest of a payload file, from FILEDIGESTS. */
+struct filedigest {
+    int algo;
+    size_t len;
+    uint8_t value[DIGEST_MAX_SIZE];
+};
+
+/* Digest of the compressed payload, checked against PAYLOADDIGEST. */
+struct paydigest {
+    struct digest d;
+    const char *expect;    /* hex, owned by the header */
+    size_t done;           /* package offset hashed up to */
+    bool active;
+    bool stream;           /* not mapped, hashed as it is read */
+    bool teeing;           /* hashed on its way to rpmio */
+    bool failed;           /* the package could not be read */
+    int in;                /* package descriptor */
+    int tee[2];            /* socket rpmio reads, and its other end */
+    const char *path;
+    pthread_t thread;
+};
+
+/* Header tag descriptor, see gentags.py. */
+struct tagdesc {
+    const char *name;       /* symbolic name, e.g. RPMTAG_NAME */
+    const char *shortname;  /* name as librpm reports it, e.g. Name */
+    rpmTagType type;        /* expected type, RPM_NULL_TYPE if none */
+    bool array;             /* may have more than one element */
 };
 
 #endif /* _TARPM_TYPES_H */
@@ -0,0 +1,177 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Base64 encoding (RFC 4648, standard alphabet, padded, no line
+ * breaks) of binary header entries.  On x86 the bulk of the input is
+ * encoded 24 or 12 bytes at a time with AVX2 or SSSE3 using the
+ * shuffle and multiply method described by Wojciech Muła; the tail
+ * and other architectures use the scalar loop.
+ */
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86
+#endif
+
+#include "tarpm.h"
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Encode n bytes, including the final padded quantum. */
+static size_t
+encode_scalar(char *dst, const uint8_t *src, size_t n)
+{
+    char *p = dst;
+    uint32_t v = 0;
+
+    while (n >= 3) {
+        v = ((uint32_t) src[0] << 16) | ((uint32_t) src[1] << 8) | src[2];
+        *p++ = alphabet[(v >> 18) & 0x3f];
+        *p++ = alphabet[(v >> 12) & 0x3f];
+        *p++ = alphabet[(v >> 6) & 0x3f];
+        *p++ = alphabet[v & 0x3f];
+        src += 3;
+        n -= 3;
+    }
+
+    if (n) {
+        v = (uint32_t) src[0] << 16;
+
+        if (n == 2) {
+            v |= (uint32_t) src[1] << 8;
+        }
+
+        *p++ = alphabet[(v >> 18) & 0x3f];
+        *p++ = alphabet[(v >> 12) & 0x3f];
+        *p++ = (n == 2) ? alphabet[(v >> 6) & 0x3f] : '=';
+        *p++ = '=';
+    }
+
+    return p - dst;
+}
+
+#ifdef BASE64_X86
+/*
+ * Spread each 3 input bytes over 4 bytes, then split them in to four
+ * 6-bit indexes, one per byte.
+ */
+__attribute__((target("avx2")))
+static inline __m256i
+indexes_avx2(__m256i in)
+{
+    __m256i t0, t1, t2, t3;
+
+    in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                                  1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(t1, t3);
+}
+
+/* Map 6-bit indexes to the alphabet by adding a per-range offset. */
+__attribute__((target("avx2")))
+static inline __m256i
+ascii_avx2(__m256i idx)
+{
+    __m256i r, less;
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+
+    r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+    r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, r), idx);
+}
+
+/*
+ * Encode 24 byte blocks and return the number of input bytes done.
+ * Each block loads 16 bytes from two places 12 bytes apart, so 4
+ * bytes past the block must be readable.
+ */
+__attribute__((target("avx2")))
+static size_t
+encode_avx2(char *dst, const uint8_t *src, const size_t n)
+{
+    size_t i = 0;
+    __m256i in;
+
+    for (i = 0; i + 28 <= n; i += 24) {
+        in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (src + i))),
+                                     _mm_loadu_si128((const __m128i *) (src + i + 12)), 1);
+        _mm256_storeu_si256((__m256i *) (dst + (i / 3 * 4)), ascii_avx2(indexes_avx2(in)));
+    }
+
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t
+encode_ssse3(char *dst, const uint8_t *src, const size_t n)
+{
+    size_t i = 0;
+    __m128i in, t0, t1, t2, t3, r, less;
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+
+    /* 12 byte blocks from 16 byte loads */
+    for (i = 0; i + 16 <= n; i += 12) {
+        in = _mm_loadu_si128((const __m128i *) (src + i));
+        in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+        t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        in = _mm_or_si128(t1, t3);
+
+        r = _mm_subs_epu8(in, _mm_set1_epi8(51));
+        less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+        r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+        _mm_storeu_si128((__m128i *) (dst + (i / 3 * 4)), _mm_add_epi8(_mm_shuffle_epi8(offsets, r), in));
+    }
+
+    return i;
+}
+#endif
+
+/*
+ * Encode n bytes at src as base64 in to dst, which must have room for
+ * base64_length(n) bytes.  No NUL is written.  Returns the number of
+ * bytes written.
+ */
+size_t
+base64_encode(char *dst, const void *src, const size_t n)
+{
+    size_t done = 0;
+
+    assert(dst != NULL);
+    assert(src != NULL || n == 0);
+
+#ifdef BASE64_X86
+    if (__builtin_cpu_supports("avx2")) {
+        done = encode_avx2(dst, src, n);
+    } else if (__builtin_cpu_supports("ssse3")) {
+        done = encode_ssse3(dst, src, n);
+    }
+#endif
+
+    return (done / 3 * 4) + encode_scalar(dst + (done / 3 * 4), (const uint8_t *) src + done, n - done);
+}
+
+/* Length of the base64 encoding of n bytes. */
+size_t
+base64_length(const size_t n)
+{
+    return (n + 2) / 3 * 4;
+}
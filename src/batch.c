@@ -0,0 +1,277 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Batch extraction.  Any number of packages are extracted by a pool
+ * of worker threads in one process, so librpm is initialized once and
+ * each worker reuses its own arena for every package it handles.
+ * Failures are reported per package and never stop the batch.  In
+ * check mode the same workers verify packages and write nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "tarpm.h"
+
+struct batch {
+    char **paths;
+    size_t npaths;
+    const char *dest;
+    const struct tarpmopts *opts;
+    atomic_size_t next;        /* next package to hand out */
+    atomic_size_t failed;      /* packages that could not be extracted */
+};
+
+/*
+ * Verify an opened package without writing anything: the header
+ * against the signature's header digest, then the payload streamed
+ * through the discarding writers with file and payload digests
+ * checked.  Returns 0 if everything matches, -1 otherwise.
+ */
+static int
+check_package(const struct rpmpkg *pkg, const struct tarpmopts *opts)
+{
+    int ret = 0;
+
+    if (check_header_digest(pkg) == -1) {
+        ret = -1;
+    }
+
+    if (extract_rpm_payload(pkg, NULL, opts) != 0) {
+        ret = -1;
+    }
+
+    if (ret == -1) {
+        warnx(_("*** %s: check failed"), pkg->path);
+    } else if (opts->verbose) {
+        printf("%s: OK\n", pkg->path);
+    }
+
+    return ret;
+}
+
+/*
+ * Extract one package in to a NEVRA named directory below dest, or
+ * with opts->check only verify it.  The arena holds metadata
+ * temporaries and is reset before returning.  Returns 0 on success,
+ * -1 on error after reporting it.
+ */
+int
+extract_package(const char *path, const char *dest, const struct tarpmopts *opts, struct arena *arena)
+{
+    int ret = -1;
+    int mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+    char *nevra = NULL;
+    char *output_dir = NULL;
+    char *payload_dir = NULL;
+    struct rpmpkg *pkg = NULL;
+
+    assert(path != NULL);
+    assert(dest != NULL);
+    assert(opts != NULL);
+    assert(arena != NULL);
+
+    /* open and parse the RPM (this is passed around) */
+    pkg = open_rpm_package(path);
+
+    if (pkg == NULL) {
+        warnx(_("*** %s is not a valid RPM"), path);
+        return -1;
+    }
+
+    if (opts->check) {
+        ret = check_package(pkg, opts);
+        close_rpm_package(pkg);
+        return ret;
+    }
+
+    /* the output directory is named for the package */
+    nevra = get_nevra(pkg->h);
+    assert(nevra != NULL);
+    output_dir = joinpath(dest, nevra, NULL);
+    assert(output_dir != NULL);
+
+    /* create the output directory */
+    if (mkdirp(output_dir, mode) == -1) {
+        goto done;
+    }
+
+    /* extract the RPM lead -- the first header (unused) */
+    if (extract_lead(pkg, output_dir, opts, arena) == -1) {
+        warnx(_("*** %s: unable to extract the lead"), path);
+        goto done;
+    }
+
+    /* extract the RPM signature -- the second header (sort of used) */
+    if (extract_signature(pkg, output_dir, opts, arena) == -1) {
+        warnx(_("*** %s: unable to extract the signature"), path);
+        goto done;
+    }
+
+    /* extract the RPM header -- the third header (used) */
+    if (extract_header(pkg, output_dir, opts, arena) == -1) {
+        warnx(_("*** %s: unable to extract the header"), path);
+        goto done;
+    }
+
+    /*
+     * Only the lead, signature, and header have been read from the
+     * package at this point; in metadata-only mode the payload is
+     * never opened.
+     */
+    if (!opts->metadata_only) {
+        /* unpack the RPM payload */
+        payload_dir = joinpath(output_dir, PAYLOAD_SUBDIR, NULL);
+        assert(payload_dir != NULL);
+
+        if (mkdirp(payload_dir, mode) == -1) {
+            goto done;
+        }
+
+        if (extract_rpm_payload(pkg, payload_dir, opts) != 0) {
+            warnx(_("*** %s: unable to extract the payload"), path);
+            goto done;
+        }
+    }
+
+    ret = 0;
+
+done:
+    free(payload_dir);
+    free(output_dir);
+    free(nevra);
+    close_rpm_package(pkg);
+
+    return ret;
+}
+
+/* Take packages from the batch until there are none left. */
+static void *
+batch_worker(void *arg)
+{
+    struct batch *b = arg;
+    struct arena *arena = NULL;
+    size_t i = 0;
+
+    arena = arena_new(ARENA_BLOCK_SIZE);
+
+    while ((i = atomic_fetch_add(&b->next, 1)) < b->npaths) {
+        if (extract_package(b->paths[i], b->dest, b->opts, arena) == -1) {
+            atomic_fetch_add(&b->failed, 1);
+        }
+    }
+
+    arena_free(arena);
+    return NULL;
+}
+
+/*
+ * Extract npaths packages in to dest using opts->jobs worker threads
+ * (or the calling thread alone when jobs is 1 or less).  librpm must
+ * already be initialized.  Returns the number of packages that failed.
+ */
+size_t
+extract_batch(char **paths, const size_t npaths, const char *dest, const struct tarpmopts *opts)
+{
+    struct batch b;
+    pthread_t *workers = NULL;
+    unsigned int nworkers = 0;
+    unsigned int i = 0;
+
+    assert(paths != NULL || npaths == 0);
+    assert(dest != NULL);
+    assert(opts != NULL);
+
+    memset(&b, 0, sizeof(b));
+    b.paths = paths;
+    b.npaths = npaths;
+    b.dest = dest;
+    b.opts = opts;
+    atomic_init(&b.next, 0);
+    atomic_init(&b.failed, 0);
+
+    nworkers = (opts->jobs > npaths) ? npaths : opts->jobs;
+
+    if (nworkers <= 1) {
+        batch_worker(&b);
+        return atomic_load(&b.failed);
+    }
+
+    workers = xcalloc(nworkers, sizeof(*workers));
+
+    for (i = 0; i < nworkers; i++) {
+        if ((errno = pthread_create(&workers[i], NULL, batch_worker, &b)) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        if ((errno = pthread_join(workers[i], NULL)) != 0) {
+            warn("pthread_join");
+        }
+    }
+
+    free(workers);
+    return atomic_load(&b.failed);
+}
+
+/*
+ * Append the package names listed one per line in listfile ("-" for
+ * standard input) to the *n entries of *paths.  Blank lines are
+ * skipped.  Returns 0 on success, -1 if the list cannot be read.
+ */
+int
+read_package_list(const char *listfile, char ***paths, size_t *n)
+{
+    FILE *fp = NULL;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len = 0;
+
+    assert(listfile != NULL);
+    assert(paths != NULL);
+    assert(n != NULL);
+
+    if (!strcmp(listfile, "-")) {
+        fp = stdin;
+    } else if ((fp = fopen(listfile, "r")) == NULL) {
+        warn("fopen %s", listfile);
+        return -1;
+    }
+
+    while ((len = getline(&line, &size, fp)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        if (len == 0) {
+            continue;
+        }
+
+        *paths = xrealloc(*paths, (*n + 1) * sizeof(**paths));
+        (*paths)[(*n)++] = strdup(line);
+        assert((*paths)[*n - 1] != NULL);
+    }
+
+    if (ferror(fp)) {
+        warn("read %s", listfile);
+        len = -2;
+    }
+
+    free(line);
+
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    return (len == -2) ? -1 : 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Convert arrays of big endian integers from the header data store to
+ * host byte order.  Arrays such as RPMTAG_FILESIZES or
+ * RPMTAG_DIRINDEXES can hold hundreds of thousands of elements, so on
+ * x86 the conversion is done with a byte shuffle over 16 or 32 bytes
+ * at a time.  The source does not need to be aligned.  Other
+ * architectures and the tail of each array use the scalar loop.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BSWAP_X86
+#endif
+
+#include "tarpm.h"
+
+static void
+scalar16(uint16_t *dst, const uint8_t *src, const size_t n)
+{
+    size_t i = 0;
+    uint16_t v = 0;
+
+    for (i = 0; i < n; i++) {
+        memcpy(&v, src + (i * sizeof(v)), sizeof(v));
+        dst[i] = be16toh(v);
+    }
+
+    return;
+}
+
+static void
+scalar32(uint32_t *dst, const uint8_t *src, const size_t n)
+{
+    size_t i = 0;
+    uint32_t v = 0;
+
+    for (i = 0; i < n; i++) {
+        memcpy(&v, src + (i * sizeof(v)), sizeof(v));
+        dst[i] = be32toh(v);
+    }
+
+    return;
+}
+
+static void
+scalar64(uint64_t *dst, const uint8_t *src, const size_t n)
+{
+    size_t i = 0;
+    uint64_t v = 0;
+
+    for (i = 0; i < n; i++) {
+        memcpy(&v, src + (i * sizeof(v)), sizeof(v));
+        dst[i] = be64toh(v);
+    }
+
+    return;
+}
+
+#ifdef BSWAP_X86
+/* pshufb masks reversing each 2, 4, or 8 byte element of a lane */
+static const uint8_t shuffle16[16] = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+static const uint8_t shuffle32[16] = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+static const uint8_t shuffle64[16] = { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 };
+
+/*
+ * Shuffle whole 32 byte blocks from src to dst and return the number
+ * of bytes done.  The element size is a divisor of the block size, so
+ * blocks never split an element.
+ */
+__attribute__((target("avx2")))
+static size_t
+shuffle_avx2(void *dst, const uint8_t *src, const size_t len, const uint8_t *lane)
+{
+    size_t i = 0;
+    __m128i m = _mm_loadu_si128((const __m128i *) lane);
+    __m256i mask = _mm256_broadcastsi128_si256(m);
+    __m256i v;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) ((uint8_t *) dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    return i;
+}
+
+/* The same with 16 byte blocks for CPUs without AVX2. */
+__attribute__((target("ssse3")))
+static size_t
+shuffle_ssse3(void *dst, const uint8_t *src, const size_t len, const uint8_t *lane)
+{
+    size_t i = 0;
+    __m128i mask = _mm_loadu_si128((const __m128i *) lane);
+    __m128i v;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) ((uint8_t *) dst + i), _mm_shuffle_epi8(v, mask));
+    }
+
+    return i;
+}
+
+/*
+ * Shuffle as much of the array as the CPU allows and return the number
+ * of bytes done.
+ */
+static size_t
+shuffle(void *dst, const uint8_t *src, const size_t len, const uint8_t *lane)
+{
+    if (__builtin_cpu_supports("avx2")) {
+        return shuffle_avx2(dst, src, len, lane);
+    } else if (__builtin_cpu_supports("ssse3")) {
+        return shuffle_ssse3(dst, src, len, lane);
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Convert n big endian 16-bit integers at src to host order in dst.
+ */
+void
+bswap16_array(uint16_t *dst, const void *src, const size_t n)
+{
+    size_t done = 0;
+
+    assert(dst != NULL);
+    assert(src != NULL || n == 0);
+
+#ifdef BSWAP_X86
+    done = shuffle(dst, src, n * sizeof(*dst), shuffle16) / sizeof(*dst);
+#endif
+
+    scalar16(dst + done, (const uint8_t *) src + (done * sizeof(*dst)), n - done);
+    return;
+}
+
+/*
+ * Convert n big endian 32-bit integers at src to host order in dst.
+ */
+void
+bswap32_array(uint32_t *dst, const void *src, const size_t n)
+{
+    size_t done = 0;
+
+    assert(dst != NULL);
+    assert(src != NULL || n == 0);
+
+#ifdef BSWAP_X86
+    done = shuffle(dst, src, n * sizeof(*dst), shuffle32) / sizeof(*dst);
+#endif
+
+    scalar32(dst + done, (const uint8_t *) src + (done * sizeof(*dst)), n - done);
+    return;
+}
+
+/*
+ * Convert n big endian 64-bit integers at src to host order in dst.
+ */
+void
+bswap64_array(uint64_t *dst, const void *src, const size_t n)
+{
+    size_t done = 0;
+
+    assert(dst != NULL);
+    assert(src != NULL || n == 0);
+
+#ifdef BSWAP_X86
+    done = shuffle(dst, src, n * sizeof(*dst), shuffle64) / sizeof(*dst);
+#endif
+
+    scalar64(dst + done, (const uint8_t *) src + (done * sizeof(*dst)), n - done);
+    return;
+}
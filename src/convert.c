@@ -0,0 +1,185 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Conversion of packages to a tar or cpio archive for --to-archive.
+ * The payloads of every package named are written one after another
+ * in to a single archive through libarchive, compressed when asked,
+ * and nothing but the archive is written.  Formats are named
+ * container[.codec], such as "tar.zst", and are otherwise taken from
+ * the archive's file name.  Tar archives are written as restricted
+ * pax, which is plain ustar unless a member needs more, and cpio
+ * archives in the newc format.  libarchive compresses zstd and xz on
+ * several threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <err.h>
+#include <archive.h>
+
+#include "tarpm.h"
+
+struct archiveformat {
+    const char *name;
+    int format;                /* ARCHIVE_FORMAT_* */
+    int filter;                /* ARCHIVE_FILTER_* */
+    const char *codec;         /* filter module for options, or NULL */
+};
+
+static const struct archiveformat formats[] = {
+    { "tar", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_NONE, NULL },
+    { "tar.gz", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_GZIP, "gzip" },
+    { "tgz", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_GZIP, "gzip" },
+    { "tar.xz", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_XZ, "xz" },
+    { "txz", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_XZ, "xz" },
+    { "tar.zst", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_ZSTD, "zstd" },
+    { "tzst", ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_ZSTD, "zstd" },
+    { "cpio", ARCHIVE_FORMAT_CPIO_SVR4_NOCRC, ARCHIVE_FILTER_NONE, NULL },
+    { "cpio.gz", ARCHIVE_FORMAT_CPIO_SVR4_NOCRC, ARCHIVE_FILTER_GZIP, "gzip" },
+    { "cpio.xz", ARCHIVE_FORMAT_CPIO_SVR4_NOCRC, ARCHIVE_FILTER_XZ, "xz" },
+    { "cpio.zst", ARCHIVE_FORMAT_CPIO_SVR4_NOCRC, ARCHIVE_FILTER_ZSTD, "zstd" },
+    { NULL, 0, 0, NULL }
+};
+
+/*
+ * Find the format named name, or when name is NULL the one the file
+ * name ends with, falling back to plain tar.  Returns NULL if name is
+ * not a known format.
+ */
+static const struct archiveformat *
+find_format(const char *name, const char *file)
+{
+    const struct archiveformat *f = NULL;
+    size_t len = strlen(file);
+    size_t n = 0;
+
+    for (f = formats; f->name != NULL; f++) {
+        n = strlen(f->name);
+
+        if (name != NULL && !strcmp(name, f->name)) {
+            return f;
+        } else if (name == NULL && len > n && file[len - n - 1] == '.' && !strcmp(file + len - n, f->name)) {
+            return f;
+        }
+    }
+
+    return (name == NULL) ? formats : NULL;
+}
+
+/* True if name is a format --archive-format accepts. */
+bool
+archive_format_valid(const char *name)
+{
+    assert(name != NULL);
+
+    return find_format(name, "") != NULL;
+}
+
+/*
+ * Create the archive writer for opts->archive ("-" for standard
+ * output).  Returns NULL on error after reporting it.
+ */
+static struct archive *
+open_archive(const struct tarpmopts *opts)
+{
+    const struct archiveformat *f = NULL;
+    struct archive *a = NULL;
+    const char *file = opts->archive;
+    char value[32];
+
+    f = find_format(opts->archive_format, file);
+    assert(f != NULL);
+
+    a = archive_write_new();
+    assert(a != NULL);
+
+    if (archive_write_set_format(a, f->format) != ARCHIVE_OK || archive_write_add_filter(a, f->filter) < ARCHIVE_WARN) {
+        warnx(_("*** unable to write %s archives: %s"), f->name, archive_error_string(a));
+        goto bad;
+    }
+
+    if (f->codec != NULL && opts->compression_level >= 0) {
+        snprintf(value, sizeof(value), "%d", opts->compression_level);
+
+        if (archive_write_set_filter_option(a, f->codec, "compression-level", value) != ARCHIVE_OK) {
+            warnx(_("*** invalid compression level %d for %s: %s"), opts->compression_level, f->codec, archive_error_string(a));
+            goto bad;
+        }
+    }
+
+    /* older libarchive versions compress on one thread */
+    if (f->codec != NULL && f->filter != ARCHIVE_FILTER_GZIP && opts->compressors > 1) {
+        snprintf(value, sizeof(value), "%u", opts->compressors);
+        archive_write_set_filter_option(a, f->codec, "threads", value);
+    }
+
+    /* archives are only padded to full blocks on tape */
+    archive_write_set_bytes_in_last_block(a, 1);
+
+    if (archive_write_open_filename(a, strcmp(file, "-") ? file : NULL) != ARCHIVE_OK) {
+        warnx("*** %s: %s", file, archive_error_string(a));
+        goto bad;
+    }
+
+    return a;
+
+bad:
+    archive_write_free(a);
+    return NULL;
+}
+
+/*
+ * Convert npaths packages in to the single archive named by
+ * opts->archive, one after another.  A package that cannot be read or
+ * converted is reported and the rest are still written.  librpm must
+ * already be initialized.  Returns the number of packages that
+ * failed, or npaths if the archive itself could not be written.
+ */
+size_t
+convert_packages(char **paths, const size_t npaths, const struct tarpmopts *opts)
+{
+    struct archive *a = NULL;
+    struct rpmpkg *pkg = NULL;
+    size_t failed = 0;
+    size_t i = 0;
+
+    assert(paths != NULL || npaths == 0);
+    assert(opts != NULL);
+    assert(opts->archive != NULL);
+
+    a = open_archive(opts);
+
+    if (a == NULL) {
+        return npaths;
+    }
+
+    for (i = 0; i < npaths; i++) {
+        pkg = open_rpm_package(paths[i]);
+
+        if (pkg == NULL) {
+            warnx(_("*** %s is not a valid RPM"), paths[i]);
+            failed++;
+            continue;
+        }
+
+        if (convert_rpm_payload(pkg, a, i, opts) != 0) {
+            warnx(_("*** %s: unable to convert the payload"), paths[i]);
+            failed++;
+        }
+
+        close_rpm_package(pkg);
+    }
+
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        warnx("*** %s: %s", opts->archive, archive_error_string(a));
+        failed = npaths;
+    }
+
+    archive_write_free(a);
+    return failed;
+}
@@ -0,0 +1,430 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Readers for the cpio archive in a payload.  Uncompressed payloads
+ * are written without a PAYLOADCOMPRESSOR (librpm reads them through
+ * gzip's transparent mode), so the archive itself is what tells them
+ * apart.  Their cpio headers are parsed in place in the mapped package
+ * and only the offset and size of each member's data are returned; the
+ * data is never read here.  Payloads decompressed by decompress.c are
+ * read as a stream instead, with member data read by the caller
+ * straight in to its own buffers.
+ *
+ * Two header formats occur: "newc" (070701, or 070702 with checksums)
+ * naming each file, and rpm's "stripped" format (07070X) carrying only
+ * the file index, used by packages with files of 4 GiB or more.  Both
+ * pad headers and data to four bytes, counted from the start of the
+ * archive, and end with a newc trailer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <err.h>
+#include <sys/stat.h>
+#include <rpm/rpmfiles.h>
+
+#include "tarpm.h"
+
+/* Parse 8 hex digits.  Returns false if they are not all hex. */
+static bool
+parse_hex(const uint8_t *p, uint32_t *out)
+{
+    unsigned int i = 0;
+    uint32_t v = 0;
+
+    for (i = 0; i < 8; i++) {
+        v <<= 4;
+
+        if (p[i] >= '0' && p[i] <= '9') {
+            v |= p[i] - '0';
+        } else if (p[i] >= 'a' && p[i] <= 'f') {
+            v |= p[i] - 'a' + 10;
+        } else if (p[i] >= 'A' && p[i] <= 'F') {
+            v |= p[i] - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+
+    *out = v;
+    return true;
+}
+
+static size_t
+pad4(const size_t n)
+{
+    return (n + 3) & ~((size_t) 3);
+}
+
+/*
+ * Size of the data stored for a file in a stripped archive, which
+ * comes from the header: the content of a regular file (only on the
+ * last of a hard link set) or the target of a symbolic link.
+ */
+static uint64_t
+stripped_size(rpmfiles files, const int fx)
+{
+    const int *links = NULL;
+    uint32_t nlinks = 0;
+    rpm_mode_t mode = rpmfilesFMode(files, fx);
+
+    if (S_ISREG(mode)) {
+        nlinks = rpmfilesFLinks(files, fx, &links);
+        return (nlinks > 1 && links[nlinks - 1] != fx) ? 0 : rpmfilesFSize(files, fx);
+    } else if (S_ISLNK(mode)) {
+        return rpmfilesFSize(files, fx);
+    }
+
+    return 0;
+}
+
+/*
+ * Size of the header starting with magic, or 0 if it is not a header
+ * this reader knows.
+ */
+static size_t
+header_size(const uint8_t *magic)
+{
+    if (!memcmp(magic, CPIO_STRIPPED_MAGIC, CPIO_MAGIC_SIZE)) {
+        return CPIO_STRIPPED_HEADER_SIZE;
+    } else if (!memcmp(magic, CPIO_NEWC_MAGIC, CPIO_MAGIC_SIZE) || !memcmp(magic, CPIO_CRC_MAGIC, CPIO_MAGIC_SIZE)) {
+        return CPIO_NEWC_HEADER_SIZE;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the file index from a stripped header and find the size of the
+ * data that follows it.  Returns false if the index is not valid.
+ */
+static bool
+stripped_member(const uint8_t *h, rpmfiles files, int *fx, uint64_t *datasize)
+{
+    uint32_t index = 0;
+
+    if (!parse_hex(h + CPIO_MAGIC_SIZE, &index) || index >= (uint32_t) rpmfilesFC(files)) {
+        return false;
+    }
+
+    *fx = index;
+    *datasize = stripped_size(files, index);
+    return true;
+}
+
+/*
+ * Read c_filesize and c_namesize, the 7th and 12th fields of a newc
+ * header.  Returns false if they are not valid.
+ */
+static bool
+newc_sizes(const uint8_t *h, uint32_t *filesize, uint32_t *namesize)
+{
+    return parse_hex(h + CPIO_MAGIC_SIZE + (6 * 8), filesize) && parse_hex(h + CPIO_MAGIC_SIZE + (11 * 8), namesize)
+           && *namesize > 0;
+}
+
+/*
+ * Find the file named in a newc header.  Returns 1 if found, 0 for the
+ * trailer, or -1 if the header does not list it.
+ */
+static int
+newc_member(const char *name, rpmfiles files, int *fx)
+{
+    if (!strcmp(name, CPIO_TRAILER)) {
+        return 0;
+    }
+
+    /* names are written as "./path" */
+    if (name[0] == '.' && name[1] == '/') {
+        name++;
+    }
+
+    *fx = rpmfilesFindFN(files, name);
+
+    if (*fx < 0) {
+        warnx(_("*** payload file %s is not in the header"), name);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * True if the payload of the package is an uncompressed cpio archive
+ * that can be read in place.  The package must be mapped.
+ */
+bool
+cpio_payload(const struct rpmpkg *pkg)
+{
+    const uint8_t *p = NULL;
+
+    assert(pkg != NULL);
+
+    if (!pkg->view.mapped || pkg->view.len < (size_t) pkg->payload_offset + CPIO_MAGIC_SIZE) {
+        return false;
+    }
+
+    p = pkg->view.data + pkg->payload_offset;
+    return !memcmp(p, CPIO_NEWC_MAGIC, CPIO_MAGIC_SIZE) || !memcmp(p, CPIO_CRC_MAGIC, CPIO_MAGIC_SIZE)
+           || !memcmp(p, CPIO_STRIPPED_MAGIC, CPIO_MAGIC_SIZE);
+}
+
+/* Start reading the payload of a package for which cpio_payload() holds. */
+void
+cpio_begin(const struct rpmpkg *pkg, struct cpioreader *r)
+{
+    assert(pkg != NULL);
+    assert(r != NULL);
+
+    r->base = pkg->payload_offset;
+    r->data = pkg->view.data + r->base;
+    r->offset = 0;
+    r->end = pkg->view.len - r->base;
+    return;
+}
+
+/*
+ * Move to the next member of the archive and return its file index in
+ * *fx and where its data is in the package in *offset and *size.
+ * %ghost files, which older rpm versions put in some payloads, are
+ * skipped.  Returns 1 for a member, 0 at the end of the archive, or -1
+ * if the archive is damaged or names a file the header does not list.
+ */
+int
+cpio_next(struct cpioreader *r, rpmfiles files, int *fx, size_t *offset, size_t *size)
+{
+    const uint8_t *h = NULL;
+    const char *name = NULL;
+    uint32_t filesize = 0;
+    uint32_t namesize = 0;
+    uint64_t datasize = 0;
+    size_t avail = 0;
+    size_t hsize = 0;
+    int rc = 0;
+
+    assert(r != NULL);
+    assert(fx != NULL);
+    assert(offset != NULL);
+    assert(size != NULL);
+
+    while (1) {
+        avail = r->end - r->offset;
+        h = r->data + r->offset;
+        hsize = (avail >= CPIO_MAGIC_SIZE) ? header_size(h) : 0;
+
+        if (hsize == 0 || avail < hsize) {
+            break;
+        }
+
+        if (hsize == CPIO_STRIPPED_HEADER_SIZE) {
+            if (!stripped_member(h, files, fx, &datasize)) {
+                break;
+            }
+
+            r->offset += pad4(CPIO_STRIPPED_HEADER_SIZE);
+        } else {
+            if (!newc_sizes(h, &filesize, &namesize) || namesize > avail - CPIO_NEWC_HEADER_SIZE
+                || h[CPIO_NEWC_HEADER_SIZE + namesize - 1] != '\0') {
+                break;
+            }
+
+            name = (const char *) h + CPIO_NEWC_HEADER_SIZE;
+
+            if ((rc = newc_member(name, files, fx)) != 1) {
+                return rc;
+            }
+
+            datasize = filesize;
+            r->offset += pad4(CPIO_NEWC_HEADER_SIZE + namesize);
+        }
+
+        if (r->offset > r->end || datasize > r->end - r->offset) {
+            break;
+        }
+
+        *offset = r->base + r->offset;
+        *size = datasize;
+        r->offset += datasize;
+        r->offset = (pad4(r->offset) > r->end) ? r->end : pad4(r->offset);
+
+        if (rpmfilesFFlags(files, *fx) & RPMFILE_GHOST) {
+            continue;
+        }
+
+        return 1;
+    }
+
+    warnx(_("*** damaged payload archive at offset %zu"), r->base + r->offset);
+    return -1;
+}
+
+/*
+ * Read exactly len bytes of the archive stream in to buf.  Returns 0
+ * on success, -1 if the stream ends early or cannot be read.
+ */
+static int
+stream_read(struct cpiostream *s, void *buf, const size_t len)
+{
+    ssize_t n = 0;
+    size_t got = 0;
+
+    while (got < len) {
+        n = decoder_read(s->dec, (uint8_t *) buf + got, len - got);
+
+        if (n <= 0) {
+            if (n == 0) {
+                warnx(_("*** payload archive ends early at offset %llu"), (unsigned long long) (s->offset + got));
+            }
+
+            return -1;
+        }
+
+        got += n;
+    }
+
+    s->offset += len;
+    return 0;
+}
+
+/* Read past len bytes of the archive stream. */
+static int
+stream_skip(struct cpiostream *s, uint64_t len)
+{
+    uint8_t buf[CPIO_SKIP_SIZE];
+    size_t n = 0;
+
+    while (len > 0) {
+        n = (len > sizeof(buf)) ? sizeof(buf) : len;
+
+        if (stream_read(s, buf, n) == -1) {
+            return -1;
+        }
+
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Start reading the archive decompressed by dec. */
+void
+cpio_stream_begin(struct cpiostream *s, struct decoder *dec)
+{
+    assert(s != NULL);
+    assert(dec != NULL);
+
+    memset(s, 0, sizeof(*s));
+    s->dec = dec;
+    return;
+}
+
+/*
+ * Move to the next member of the archive stream and return its file
+ * index in *fx and the size of its data in *size.  Whatever the caller
+ * did not read of the previous member's data is skipped.  The data
+ * itself is read with cpio_stream_read().  Returns 1 for a member, 0
+ * at the end of the archive, or -1 on error, like cpio_next().
+ */
+int
+cpio_stream_next(struct cpiostream *s, rpmfiles files, int *fx, uint64_t *size)
+{
+    uint8_t h[CPIO_NEWC_HEADER_SIZE];
+    char *name = NULL;
+    uint32_t filesize = 0;
+    uint32_t namesize = 0;
+    uint64_t datasize = 0;
+    size_t hsize = 0;
+    int rc = 0;
+
+    assert(s != NULL);
+    assert(fx != NULL);
+    assert(size != NULL);
+
+    while (1) {
+        if (stream_skip(s, s->left + (pad4(s->offset + s->left) - (s->offset + s->left))) == -1) {
+            return -1;
+        }
+
+        s->left = 0;
+
+        if (stream_read(s, h, CPIO_MAGIC_SIZE) == -1) {
+            return -1;
+        }
+
+        hsize = header_size(h);
+
+        if (hsize == 0 || stream_read(s, h + CPIO_MAGIC_SIZE, hsize - CPIO_MAGIC_SIZE) == -1) {
+            break;
+        }
+
+        if (hsize == CPIO_STRIPPED_HEADER_SIZE) {
+            if (!stripped_member(h, files, fx, &datasize)) {
+                break;
+            }
+        } else {
+            if (!newc_sizes(h, &filesize, &namesize) || namesize > CPIO_NAME_MAX) {
+                break;
+            }
+
+            name = xalloc(namesize);
+
+            if (stream_read(s, name, namesize) == -1 || name[namesize - 1] != '\0') {
+                free(name);
+                break;
+            }
+
+            rc = newc_member(name, files, fx);
+            free(name);
+
+            if (rc != 1) {
+                return rc;
+            }
+
+            datasize = filesize;
+        }
+
+        if (stream_skip(s, pad4(s->offset) - s->offset) == -1) {
+            return -1;
+        }
+
+        s->left = datasize;
+
+        if (rpmfilesFFlags(files, *fx) & RPMFILE_GHOST) {
+            continue;
+        }
+
+        *size = datasize;
+        return 1;
+    }
+
+    warnx(_("*** damaged payload archive at offset %llu"), (unsigned long long) s->offset);
+    return -1;
+}
+
+/*
+ * Read up to len bytes of the current member's data in to buf.
+ * Returns the number of bytes read, 0 once all of it has been, or -1
+ * on error.
+ */
+ssize_t
+cpio_stream_read(struct cpiostream *s, void *buf, size_t len)
+{
+    assert(s != NULL);
+
+    len = (len > s->left) ? s->left : len;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (stream_read(s, buf, len) == -1) {
+        return -1;
+    }
+
+    s->left -= len;
+    return len;
+}
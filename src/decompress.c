@@ -0,0 +1,625 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Native payload decompression for xz, zstd, and gzip.  rpmio
+ * decompresses on the calling thread alone, which leaves a large
+ * payload running at single-core speed.  Here an xz payload written
+ * by a threaded compressor (a 'T' in PAYLOADFLAGS) is split in to
+ * independent blocks and goes through liblzma's threaded block
+ * decoder, a zstd payload made of several frames has its frames
+ * decoded at the same time by worker threads, and a gzip payload is
+ * split speculatively by gunzip.c.  Either way the output comes back
+ * in order as one stream, which cpio.c parses in to payload members.
+ *
+ * Compressed input is read from the mapped package.  When the package
+ * is not mapped, the bytes already in the view come first and the
+ * rest is read from the descriptor; zstd frames are then decoded one
+ * after the other, since they cannot be found ahead of time, and the
+ * payload digest is computed here as the input is read, since there
+ * is no mapping to hash it from afterwards.
+ *
+ * Other compressors, builds without liblzma or libzstd, and gzip
+ * payloads that are not mapped or too small to split are left to
+ * rpmio: decoder_open() returns NULL for them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <rpm/header.h>
+
+#ifdef _HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+#ifdef _HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "tarpm.h"
+
+enum decoder_kind {
+    DECODER_XZ,
+    DECODER_ZSTD,                  /* streamed, one frame after another */
+    DECODER_ZSTD_FRAMES,           /* frames decoded by worker threads */
+    DECODER_GZIP
+};
+
+enum frame_state {
+    FRAME_QUEUED,
+    FRAME_DONE,
+    FRAME_FAILED
+};
+
+/* One zstd frame and, once a worker has decoded it, its content. */
+struct frame {
+    const uint8_t *src;
+    size_t srclen;
+    uint8_t *out;
+    size_t outlen;                 /* from the frame header */
+    enum frame_state state;
+};
+
+struct decoder {
+    const struct rpmpkg *pkg;
+    enum decoder_kind kind;
+
+    /* compressed input: the mapped payload, or inbuf refilled from fd */
+    const uint8_t *in;
+    size_t inlen;
+    size_t inpos;
+    uint8_t *inbuf;
+    bool eof;                      /* nothing more to read from fd */
+    size_t position;               /* package offset of in */
+    struct digest *digest;         /* hashes input read from fd, or NULL */
+    bool done;
+    struct gunzip *gz;
+
+#ifdef _HAVE_LIBLZMA
+    lzma_stream xz;
+#endif
+
+#ifdef _HAVE_LIBZSTD
+    ZSTD_DStream *zds;
+    size_t zret;                   /* last ZSTD_decompressStream() result */
+
+    /* DECODER_ZSTD_FRAMES */
+    struct frame *frames;
+    size_t nframes;
+    size_t next;                   /* next frame for a worker */
+    size_t cur;                    /* frame being read */
+    size_t pos;                    /* read so far of the current frame */
+    size_t inflight;               /* bytes of decoded frames not yet read */
+    bool stop;
+    pthread_t *workers;
+    unsigned int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+#if defined(_HAVE_LIBLZMA) || defined(_HAVE_LIBZSTD)
+/*
+ * Make more compressed input available when all of it has been used.
+ * Returns 0 on success (with d->eof set when there is no more), -1 on
+ * a read error.
+ */
+static int
+fill_input(struct decoder *d)
+{
+    ssize_t n = 0;
+
+    if (d->inpos < d->inlen || d->eof) {
+        return 0;
+    }
+
+    if (d->pkg->view.mapped) {
+        d->eof = true;
+        return 0;
+    }
+
+    if (d->inbuf == NULL) {
+        d->inbuf = xalloc(DECODER_INPUT_SIZE);
+    }
+
+    do {
+        n = read(d->pkg->fd, d->inbuf, DECODER_INPUT_SIZE);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        warn("read %s", d->pkg->path);
+        return -1;
+    }
+
+    if (d->digest != NULL) {
+        digest_update(d->digest, d->inbuf, n);
+    }
+
+    d->position += d->inlen;
+    d->in = d->inbuf;
+    d->inlen = n;
+    d->inpos = 0;
+    d->eof = (n == 0);
+    return 0;
+}
+#endif
+
+#ifdef _HAVE_LIBLZMA
+/*
+ * Start an xz decoder.  Payloads from a threaded compressor have many
+ * blocks with their sizes recorded, which is what lets the threaded
+ * decoder hand them to separate threads; other payloads are a single
+ * block and gain nothing from it.
+ */
+static bool
+xz_open(struct decoder *d, const char *flags, const unsigned int threads)
+{
+    lzma_ret rc = LZMA_OK;
+    lzma_mt mt;
+    lzma_stream init = LZMA_STREAM_INIT;
+
+    d->xz = init;
+
+    if (threads > 1 && flags != NULL && strchr(flags, 'T') != NULL) {
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = threads;
+        mt.memlimit_stop = UINT64_MAX;
+
+        /* past this the decoder goes single threaded rather than fail */
+        mt.memlimit_threading = lzma_physmem() / 4;
+
+        if (mt.memlimit_threading == 0) {
+            mt.memlimit_threading = UINT64_MAX;
+        }
+
+        rc = lzma_stream_decoder_mt(&d->xz, &mt);
+    } else {
+        rc = lzma_stream_decoder(&d->xz, UINT64_MAX, 0);
+    }
+
+    if (rc != LZMA_OK) {
+        warnx(_("*** %s: unable to start the xz decoder (%d)"), d->pkg->path, rc);
+        return false;
+    }
+
+    d->kind = DECODER_XZ;
+    return true;
+}
+
+static ssize_t
+xz_read(struct decoder *d, void *buf, const size_t len)
+{
+    lzma_ret rc = LZMA_OK;
+
+    d->xz.next_out = buf;
+    d->xz.avail_out = len;
+
+    while (d->xz.avail_out > 0 && !d->done) {
+        if (fill_input(d) == -1) {
+            return -1;
+        }
+
+        d->xz.next_in = d->in + d->inpos;
+        d->xz.avail_in = d->inlen - d->inpos;
+        rc = lzma_code(&d->xz, d->eof ? LZMA_FINISH : LZMA_RUN);
+        d->inpos = d->inlen - d->xz.avail_in;
+
+        if (rc == LZMA_STREAM_END) {
+            d->done = true;
+        } else if (rc != LZMA_OK) {
+            /* LZMA_BUF_ERROR here means the payload is truncated */
+            warnx(_("*** %s: damaged xz payload (%d)"), d->pkg->path, rc);
+            return -1;
+        }
+    }
+
+    return len - d->xz.avail_out;
+}
+#endif
+
+#ifdef _HAVE_LIBZSTD
+static bool
+zstd_stream_open(struct decoder *d)
+{
+    d->zds = ZSTD_createDStream();
+
+    if (d->zds == NULL) {
+        warnx(_("*** %s: unable to start the zstd decoder"), d->pkg->path);
+        return false;
+    }
+
+    /* rpm's long distance mode writes windows past the default limit */
+    ZSTD_DCtx_setParameter(d->zds, ZSTD_d_windowLogMax, DECODER_ZSTD_WINDOWLOG_MAX);
+    d->kind = DECODER_ZSTD;
+    return true;
+}
+
+static ssize_t
+zstd_stream_read(struct decoder *d, void *buf, const size_t len)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out = { buf, len, 0 };
+    size_t before = 0;
+
+    while (out.pos < out.size && !d->done) {
+        if (fill_input(d) == -1) {
+            return -1;
+        }
+
+        /* the input ended where a frame did */
+        if (d->eof && d->inpos == d->inlen && d->zret == 0) {
+            d->done = true;
+            break;
+        }
+
+        in.src = d->in;
+        in.size = d->inlen;
+        in.pos = d->inpos;
+        before = out.pos;
+        d->zret = ZSTD_decompressStream(d->zds, &out, &in);
+        d->inpos = in.pos;
+
+        if (ZSTD_isError(d->zret)) {
+            warnx(_("*** %s: damaged zstd payload: %s"), d->pkg->path, ZSTD_getErrorName(d->zret));
+            return -1;
+        }
+
+        /* nothing left to give it and the frame is not finished */
+        if (d->eof && d->inpos == d->inlen && d->zret != 0 && out.pos == before) {
+            warnx(_("*** %s: truncated zstd payload"), d->pkg->path);
+            return -1;
+        }
+    }
+
+    return out.pos;
+}
+
+/*
+ * Split a mapped zstd payload in to frames.  Frames can only be
+ * decoded apart when there are several and each records its content
+ * size, as pzstd and other parallel compressors write them; rpm's own
+ * threaded compression writes a single frame.  Returns true if the
+ * payload should be decoded a frame per worker.
+ */
+static bool
+zstd_split(struct decoder *d)
+{
+    const uint8_t *src = d->in;
+    size_t left = d->inlen;
+    size_t size = 0;
+    unsigned long long content = 0;
+
+    while (left > 0) {
+        size = ZSTD_findFrameCompressedSize(src, left);
+        content = ZSTD_getFrameContentSize(src, left);
+
+        if (ZSTD_isError(size) || content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR
+            || content > DECODER_FRAME_MAX) {
+            break;
+        }
+
+        d->frames = xrealloc(d->frames, (d->nframes + 1) * sizeof(*d->frames));
+        memset(&d->frames[d->nframes], 0, sizeof(*d->frames));
+        d->frames[d->nframes].src = src;
+        d->frames[d->nframes].srclen = size;
+        d->frames[d->nframes].outlen = content;
+        d->nframes++;
+        src += size;
+        left -= size;
+    }
+
+    if (left > 0 || d->nframes < 2) {
+        free(d->frames);
+        d->frames = NULL;
+        d->nframes = 0;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Decode frames in the order they were claimed.  A worker waits while
+ * the frames decoded but not yet read would exceed the in-flight limit,
+ * unless its frame is the one being read, so memory stays bounded and
+ * the reader never waits on a frame nobody is decoding.
+ */
+static void *
+frame_worker(void *arg)
+{
+    struct decoder *d = arg;
+    struct frame *f = NULL;
+    ZSTD_DCtx *dctx = NULL;
+    size_t r = 0;
+
+    dctx = ZSTD_createDCtx();
+    assert(dctx != NULL);
+    ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, DECODER_ZSTD_WINDOWLOG_MAX);
+    pthread_mutex_lock(&d->lock);
+
+    while (1) {
+        while (!d->stop && d->next < d->nframes && d->next != d->cur
+               && d->inflight + d->frames[d->next].outlen > DECODER_INFLIGHT_MAX) {
+            pthread_cond_wait(&d->cond, &d->lock);
+        }
+
+        if (d->stop || d->next >= d->nframes) {
+            break;
+        }
+
+        f = &d->frames[d->next++];
+        d->inflight += f->outlen;
+        pthread_mutex_unlock(&d->lock);
+
+        f->out = xalloc(f->outlen ? f->outlen : 1);
+        r = ZSTD_decompressDCtx(dctx, f->out, f->outlen, f->src, f->srclen);
+
+        pthread_mutex_lock(&d->lock);
+        f->state = (ZSTD_isError(r) || r != f->outlen) ? FRAME_FAILED : FRAME_DONE;
+        pthread_cond_broadcast(&d->cond);
+    }
+
+    pthread_mutex_unlock(&d->lock);
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+static void
+frames_start(struct decoder *d, const unsigned int threads)
+{
+    unsigned int i = 0;
+
+    d->nworkers = (threads > d->nframes) ? d->nframes : threads;
+    d->workers = xcalloc(d->nworkers, sizeof(*d->workers));
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+    d->kind = DECODER_ZSTD_FRAMES;
+
+    for (i = 0; i < d->nworkers; i++) {
+        if (pthread_create(&d->workers[i], NULL, frame_worker, d) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    return;
+}
+
+static ssize_t
+frames_read(struct decoder *d, void *buf, const size_t len)
+{
+    struct frame *f = NULL;
+    size_t got = 0;
+    size_t n = 0;
+
+    while (got < len && d->cur < d->nframes) {
+        f = &d->frames[d->cur];
+        pthread_mutex_lock(&d->lock);
+
+        while (f->state == FRAME_QUEUED) {
+            pthread_cond_wait(&d->cond, &d->lock);
+        }
+
+        pthread_mutex_unlock(&d->lock);
+
+        if (f->state == FRAME_FAILED) {
+            warnx(_("*** %s: damaged zstd payload frame %zu"), d->pkg->path, d->cur);
+            return -1;
+        }
+
+        n = f->outlen - d->pos;
+        n = (n > len - got) ? len - got : n;
+        memcpy((uint8_t *) buf + got, f->out + d->pos, n);
+        d->pos += n;
+        got += n;
+
+        if (d->pos < f->outlen) {
+            continue;
+        }
+
+        /* the frame is used up, make room for the workers */
+        free(f->out);
+        f->out = NULL;
+        d->pos = 0;
+        d->inpos = (f->src + f->srclen) - d->in;
+
+        pthread_mutex_lock(&d->lock);
+        d->inflight -= f->outlen;
+        d->cur++;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    return got;
+}
+
+static void
+frames_stop(struct decoder *d)
+{
+    unsigned int i = 0;
+    size_t j = 0;
+
+    pthread_mutex_lock(&d->lock);
+    d->stop = true;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+
+    for (i = 0; i < d->nworkers; i++) {
+        pthread_join(d->workers[i], NULL);
+    }
+
+    for (j = 0; j < d->nframes; j++) {
+        free(d->frames[j].out);
+    }
+
+    pthread_cond_destroy(&d->cond);
+    pthread_mutex_destroy(&d->lock);
+    free(d->workers);
+    free(d->frames);
+    return;
+}
+#endif
+
+/*
+ * Start decompressing the payload of pkg natively, with up to threads
+ * threads.  Returns NULL if the payload's compressor is not one handled
+ * here, in which case the caller reads it through rpmio.
+ */
+struct decoder *
+decoder_open(const struct rpmpkg *pkg, const unsigned int threads)
+{
+    struct decoder *d = NULL;
+    const char *compr = NULL;
+#ifdef _HAVE_LIBLZMA
+    const char *flags = NULL;
+#endif
+    bool ok = false;
+
+    assert(pkg != NULL);
+
+    compr = headerGetString(pkg->h, RPMTAG_PAYLOADCOMPRESSOR);
+
+    if ((size_t) pkg->payload_offset > pkg->view.len) {
+        return NULL;
+    }
+
+    /* rpm's default */
+    if (compr == NULL) {
+        compr = "gzip";
+    }
+
+    d = xalloc(sizeof(*d));
+    d->pkg = pkg;
+    d->position = pkg->payload_offset;
+    d->in = pkg->view.data + pkg->payload_offset;
+    d->inlen = pkg->view.len - pkg->payload_offset;
+
+    if (!strcmp(compr, "gzip") && pkg->view.mapped && (d->gz = gunzip_open(pkg->path, d->in, d->inlen, threads)) != NULL) {
+        d->kind = DECODER_GZIP;
+        ok = true;
+    }
+
+#ifdef _HAVE_LIBLZMA
+    if (!strcmp(compr, "xz")) {
+        flags = headerGetString(pkg->h, RPMTAG_PAYLOADFLAGS);
+        ok = xz_open(d, flags, threads);
+    }
+#endif
+
+#ifdef _HAVE_LIBZSTD
+    if (!strcmp(compr, "zstd")) {
+        if (threads > 1 && pkg->view.mapped && zstd_split(d)) {
+            frames_start(d, threads);
+            ok = true;
+        } else {
+            ok = zstd_stream_open(d);
+        }
+    }
+#endif
+
+    if (!ok) {
+        free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+/*
+ * Read up to len bytes of the decompressed payload in to buf.
+ * Returns the number of bytes read, 0 at the end of the payload, or
+ * -1 on error after reporting it.
+ */
+ssize_t
+decoder_read(struct decoder *d, void *buf, const size_t len)
+{
+    assert(d != NULL);
+    assert(buf != NULL);
+
+    switch (d->kind) {
+        case DECODER_GZIP:
+            return gunzip_read(d->gz, buf, len);
+#ifdef _HAVE_LIBLZMA
+        case DECODER_XZ:
+            return xz_read(d, buf, len);
+#endif
+#ifdef _HAVE_LIBZSTD
+        case DECODER_ZSTD:
+            return zstd_stream_read(d, buf, len);
+        case DECODER_ZSTD_FRAMES:
+            return frames_read(d, buf, len);
+#endif
+        default:
+            break;
+    }
+
+    return -1;
+}
+
+/*
+ * Package offset up to which the compressed payload has been used,
+ * for hashing it behind the decoder.
+ */
+size_t
+decoder_position(const struct decoder *d)
+{
+    assert(d != NULL);
+
+    if (d->kind == DECODER_GZIP) {
+        return d->position + gunzip_position(d->gz);
+    }
+
+    return d->position + d->inpos;
+}
+
+/*
+ * Hash the compressed input of a package that is not mapped in to dg
+ * as it is read, starting with what is already in the view.  Must be
+ * called before anything is read from d.
+ */
+void
+decoder_digest(struct decoder *d, struct digest *dg)
+{
+    assert(d != NULL);
+    assert(dg != NULL);
+    assert(!d->pkg->view.mapped);
+    assert(d->position == (size_t) d->pkg->payload_offset && d->inpos == 0);
+
+    digest_update(dg, d->in, d->inlen);
+    d->digest = dg;
+    return;
+}
+
+void
+decoder_close(struct decoder *d)
+{
+    if (d == NULL) {
+        return;
+    }
+
+    gunzip_close(d->gz);
+
+#ifdef _HAVE_LIBLZMA
+    if (d->kind == DECODER_XZ) {
+        lzma_end(&d->xz);
+    }
+#endif
+
+#ifdef _HAVE_LIBZSTD
+    if (d->kind == DECODER_ZSTD) {
+        ZSTD_freeDStream(d->zds);
+    } else if (d->kind == DECODER_ZSTD_FRAMES) {
+        frames_stop(d);
+    }
+#endif
+
+    free(d->inbuf);
+    free(d);
+    return;
+}
@@ -5,109 +5,162 @@
 
 #include <assert.h>
 #include <string.h>
-#include <err.h>
 #include <arpa/inet.h>
-#include <rpm/rpmbase64.h>
-#include <json.h>
 
 #include "tarpm.h"
 
+/*
+ * Write count big endian integers of the given width as JSON values.
+ * They are converted to host order a block at a time in to a buffer
+ * on the stack, so large arrays need no allocation.
+ */
+static void
+add_int_values(struct jsonw *w, const uint8_t *data, const uint32_t count, const size_t width)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t n = 0;
+    union {
+        uint16_t u16[ENTRY_DECODE_BLOCK];
+        uint32_t u32[ENTRY_DECODE_BLOCK];
+        uint64_t u64[ENTRY_DECODE_BLOCK];
+    } v;
+
+    for (i = 0; i < count; i += n) {
+        n = count - i;
+
+        if (n > ENTRY_DECODE_BLOCK) {
+            n = ENTRY_DECODE_BLOCK;
+        }
+
+        switch (width) {
+            case sizeof(uint16_t):
+                bswap16_array(v.u16, data + (i * width), n);
+
+                for (j = 0; j < n; j++) {
+                    json_uint(w, NULL, v.u16[j]);
+                }
+
+                break;
+            case sizeof(uint32_t):
+                bswap32_array(v.u32, data + (i * width), n);
+
+                for (j = 0; j < n; j++) {
+                    json_uint(w, NULL, v.u32[j]);
+                }
+
+                break;
+            case sizeof(uint64_t):
+                bswap64_array(v.u64, data + (i * width), n);
+
+                for (j = 0; j < n; j++) {
+                    json_uint(w, NULL, v.u64[j]);
+                }
+
+                break;
+            default:
+                assert(!"unsupported integer width");
+        }
+    }
+
+    return;
+}
+
+/*
+ * Write count NUL terminated strings as JSON values.  Each string is
+ * found with memchr(), which the C library scans a vector at a time.
+ */
+static void
+add_string_values(struct jsonw *w, const uint8_t *data, const uint8_t *end, const uint32_t count)
+{
+    uint32_t i = 0;
+    const uint8_t *nul = NULL;
+
+    for (i = 0; i < count; i++) {
+        nul = memchr(data, '\0', end - data);
+        assert(nul != NULL);
+        json_stringn(w, NULL, (const char *) data, nul - data);
+        data = nul + 1;
+    }
+
+    return;
+}
+
+/*
+ * Decode the value of an entry and write it to the current JSON
+ * object.  Array types (everything that may have a count greater than
+ * one) are written in full as the "values" array.  Single strings,
+ * binary data, and the null type are written as "value".  The entry
+ * must have been bounds checked against the len byte data store when
+ * the section was read.
+ */
 void
-add_entry_value(struct json_object *arrayentry, uint8_t *buffer, uint32_t offset, rpmTagType datatype, uint32_t count)
+add_entry_value(struct jsonw *w, const uint8_t *buffer, const size_t len, uint32_t offset, rpmTagType datatype, uint32_t count)
 {
     uint32_t i = 0;
-/*    uint32_t j = 0; */
-    uint8_t *data = NULL;
-    union datatypes dt;
-    void *blob = NULL;
-    char *s = NULL;
-    uint8_t *p = NULL;
-
-    assert(arrayentry != NULL);
+    const uint8_t *data = NULL;
+
+    assert(w != NULL);
     assert(buffer != NULL);
+    assert(offset <= len);
 
     /* move to the position of this entry's data */
     data = buffer + offset;
 
-    /* read the value */
+    /* read and write the value */
     switch (datatype) {
         case RPM_NULL_TYPE:
-            s = strdup("(null)");
+            json_string(w, RPM_ENTRY_VALUE_DESC, "(null)");
             break;
         case RPM_CHAR_TYPE:
-            memcpy(&dt.c, data, sizeof(dt.c));
-            xasprintf(&s, "%c", dt.c);
+            json_begin_array(w, RPM_ENTRY_VALUES_DESC);
+
+            for (i = 0; i < count; i++) {
+                json_stringn(w, NULL, (const char *) data + i, 1);
+            }
+
+            json_end_array(w);
             break;
         case RPM_INT8_TYPE:
-            memcpy(&dt.i8, data, sizeof(dt.i8));
-            xasprintf(&s, "%d", dt.i8);
+            json_begin_array(w, RPM_ENTRY_VALUES_DESC);
+
+            for (i = 0; i < count; i++) {
+                json_uint(w, NULL, data[i]);
+            }
+
+            json_end_array(w);
             break;
         case RPM_INT16_TYPE:
-            memcpy(&dt.i16, data, sizeof(dt.i16));
-            dt.i16 = ntohl(dt.i16);
-            xasprintf(&s, "%d", dt.i16);
+            json_begin_array(w, RPM_ENTRY_VALUES_DESC);
+            add_int_values(w, data, count, sizeof(uint16_t));
+            json_end_array(w);
             break;
         case RPM_INT32_TYPE:
-            memcpy(&dt.i32, data, sizeof(dt.i32));
-            dt.i32 = ntohl(dt.i32);
-            xasprintf(&s, "%d", dt.i32);
+            json_begin_array(w, RPM_ENTRY_VALUES_DESC);
+            add_int_values(w, data, count, sizeof(uint32_t));
+            json_end_array(w);
             break;
         case RPM_INT64_TYPE:
-            memcpy(&dt.i64, data, sizeof(dt.i64));
-            dt.i64 = ntohl(dt.i64);
-            xasprintf(&s, "%ld", dt.i64);
+            json_begin_array(w, RPM_ENTRY_VALUES_DESC);
+            add_int_values(w, data, count, sizeof(uint64_t));
+            json_end_array(w);
             break;
         case RPM_STRING_TYPE:
-            s = strdup((char *) data);
+            json_string(w, RPM_ENTRY_VALUE_DESC, (const char *) data);
             break;
         case RPM_BIN_TYPE:
-            blob = xalloc(count);
-            assert(blob != NULL);
-            memcpy(blob, data, count);
-            s = rpmBase64Encode(blob, count, -1);
-            free(blob);
-
-            if (s == NULL) {
-                err(EXIT_FAILURE, "rpmBase64Encode");
-            }
-
+            json_base64(w, RPM_ENTRY_VALUE_DESC, data, count);
             break;
         case RPM_STRING_ARRAY_TYPE:
-
-//p = s = strdup((char *) data);
-/* j = 0; */
-p = data;
-int c;
-
-for (i = 0; i < count; i++) {
-    c = printf("|%s|\n", (char *) p);
-    p += c - 2;
-
-/*
-    while (*s != '\0') {
-         j++;
-    }
-*/
-}
-
-            /* XXX: return "argv"; */
-            break;
         case RPM_I18NSTRING_TYPE:
-            s = strdup((char *) data);
+            json_begin_array(w, RPM_ENTRY_VALUES_DESC);
+            add_string_values(w, data, buffer + len, count);
+            json_end_array(w);
             break;
         default:
-            s = strdup("(unknown)");
+            json_string(w, RPM_ENTRY_VALUE_DESC, "(unknown)");
             break;
     }
 
-    /* add the value */
-    if (s == NULL) {
-        s = strdup("");
-        assert(s != NULL);
-    }
-
-    json_object_object_add(arrayentry, RPM_ENTRY_VALUE_DESC, json_object_new_string(s));
-    free(s);
-
     return;
 }
@@ -0,0 +1,373 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Payload member selection for --include, --exclude, and member names
+ * given on the command line.  Patterns are compiled once: names with
+ * no wildcards go in a sorted table searched for the path and each of
+ * its leading directories, and glob patterns keep their literal prefix
+ * so most paths are rejected without calling fnmatch().  Selection is
+ * decided from the header's file list before the payload is read, so
+ * the number of members to write is known and reading can stop as
+ * soon as the last one has been written.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fnmatch.h>
+#include <err.h>
+#include <sys/types.h>
+#include <rpm/rpmfiles.h>
+
+#include "tarpm.h"
+
+struct glob {
+    char *pattern;
+    size_t prefix;             /* bytes before the first wildcard */
+};
+
+struct patternset {
+    char **literals;           /* sorted by filter_compile() */
+    size_t nliterals;
+    struct glob *globs;
+    size_t nglobs;
+};
+
+struct filter {
+    struct patternset include;
+    struct patternset exclude;
+    struct patternset members; /* never globs, like tar(1) */
+    bool compiled;
+};
+
+/*
+ * Strip the leading "/" and "./" and any trailing "/" from a path or
+ * pattern, so both compare the way member paths are written.
+ */
+static char *
+normalize(const char *s)
+{
+    char *r = NULL;
+    size_t len = 0;
+
+    while (*s == '/' || (s[0] == '.' && s[1] == '/')) {
+        s += (*s == '/') ? 1 : 2;
+    }
+
+    r = strdup(s);
+    assert(r != NULL);
+    len = strlen(r);
+
+    while (len > 0 && r[len - 1] == '/') {
+        r[--len] = '\0';
+    }
+
+    return r;
+}
+
+static void
+add_pattern(struct patternset *ps, const char *pattern, const bool wildcards)
+{
+    char *p = normalize(pattern);
+    size_t prefix = strcspn(p, "*?[\\");
+
+    if (!wildcards || p[prefix] == '\0') {
+        ps->literals = xrealloc(ps->literals, (ps->nliterals + 1) * sizeof(*ps->literals));
+        ps->literals[ps->nliterals++] = p;
+        return;
+    }
+
+    ps->globs = xrealloc(ps->globs, (ps->nglobs + 1) * sizeof(*ps->globs));
+    ps->globs[ps->nglobs].pattern = p;
+    ps->globs[ps->nglobs].prefix = prefix;
+    ps->nglobs++;
+    return;
+}
+
+static int
+literal_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Sort the literals and drop repeats, so each is found and seen once. */
+static void
+sort_literals(struct patternset *ps)
+{
+    size_t i = 0;
+    size_t n = 0;
+
+    if (ps->nliterals == 0) {
+        return;
+    }
+
+    qsort(ps->literals, ps->nliterals, sizeof(*ps->literals), literal_cmp);
+
+    for (i = 0; i < ps->nliterals; i++) {
+        if (n > 0 && !strcmp(ps->literals[i], ps->literals[n - 1])) {
+            free(ps->literals[i]);
+            continue;
+        }
+
+        ps->literals[n++] = ps->literals[i];
+    }
+
+    ps->nliterals = n;
+    return;
+}
+
+/*
+ * Binary search the sorted literals for the first len bytes of path.
+ * Returns the index of the match or -1.
+ */
+static ssize_t
+find_literal(const struct patternset *ps, const char *path, const size_t len)
+{
+    size_t lo = 0;
+    size_t hi = ps->nliterals;
+    size_t mid = 0;
+    int c = 0;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        c = strncmp(path, ps->literals[mid], len);
+
+        /* equal so far, but the literal may be longer */
+        if (c == 0 && ps->literals[mid][len] != '\0') {
+            c = -1;
+        }
+
+        if (c == 0) {
+            return mid;
+        } else if (c < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Return the index of the literal that names path or one of its
+ * leading directories, or -1 if none does.
+ */
+static ssize_t
+match_literal(const struct patternset *ps, const char *path)
+{
+    size_t len = strlen(path);
+    ssize_t i = -1;
+
+    if (ps->nliterals == 0) {
+        return -1;
+    }
+
+    while (1) {
+        if ((i = find_literal(ps, path, len)) != -1 || len == 0) {
+            return i;
+        }
+
+        while (len > 0 && path[len - 1] != '/') {
+            len--;
+        }
+
+        /* drop the slash too, unless it was the leading one */
+        if (len > 0) {
+            len--;
+        }
+    }
+}
+
+/* True if a glob matches path or one of its leading directories. */
+static bool
+match_glob(const struct patternset *ps, const char *path)
+{
+    size_t i = 0;
+
+    for (i = 0; i < ps->nglobs; i++) {
+        if (strncmp(path, ps->globs[i].pattern, ps->globs[i].prefix)) {
+            continue;
+        }
+
+        if (fnmatch(ps->globs[i].pattern, path, FNM_LEADING_DIR) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+free_patterns(struct patternset *ps)
+{
+    size_t i = 0;
+
+    for (i = 0; i < ps->nliterals; i++) {
+        free(ps->literals[i]);
+    }
+
+    for (i = 0; i < ps->nglobs; i++) {
+        free(ps->globs[i].pattern);
+    }
+
+    free(ps->literals);
+    free(ps->globs);
+    return;
+}
+
+struct filter *
+filter_new(void)
+{
+    return xalloc(sizeof(struct filter));
+}
+
+/* Select payload paths matching pattern (--include). */
+void
+filter_include(struct filter *f, const char *pattern)
+{
+    assert(f != NULL);
+    assert(!f->compiled);
+
+    add_pattern(&f->include, pattern, true);
+    return;
+}
+
+/* Skip payload paths matching pattern (--exclude). */
+void
+filter_exclude(struct filter *f, const char *pattern)
+{
+    assert(f != NULL);
+    assert(!f->compiled);
+
+    add_pattern(&f->exclude, pattern, true);
+    return;
+}
+
+/*
+ * Select a payload member by name, along with everything below it if
+ * it is a directory.  A member that does not exist is an error.
+ */
+void
+filter_member(struct filter *f, const char *name)
+{
+    assert(f != NULL);
+    assert(!f->compiled);
+
+    add_pattern(&f->members, name, false);
+    return;
+}
+
+/* Finish adding patterns.  The filter is read only from here on. */
+void
+filter_compile(struct filter *f)
+{
+    assert(f != NULL);
+
+    sort_literals(&f->include);
+    sort_literals(&f->exclude);
+    sort_literals(&f->members);
+    f->compiled = true;
+    return;
+}
+
+void
+filter_free(struct filter *f)
+{
+    if (f == NULL) {
+        return;
+    }
+
+    free_patterns(&f->include);
+    free_patterns(&f->exclude);
+    free_patterns(&f->members);
+    free(f);
+    return;
+}
+
+/*
+ * True if the payload path is selected.  When a member name matches,
+ * its entry in seen (one per member name) is set.  Safe to call from
+ * any number of threads at once.
+ */
+bool
+filter_match(const struct filter *f, const char *path, bool *seen)
+{
+    bool selected = false;
+    ssize_t i = -1;
+
+    assert(f != NULL);
+    assert(f->compiled);
+    assert(path != NULL);
+
+    path += strspn(path, "/");
+
+    if (f->include.nliterals == 0 && f->include.nglobs == 0 && f->members.nliterals == 0) {
+        selected = true;
+    } else if ((i = match_literal(&f->members, path)) != -1) {
+        selected = true;
+
+        if (seen != NULL) {
+            seen[i] = true;
+        }
+    } else {
+        selected = match_literal(&f->include, path) != -1 || match_glob(&f->include, path);
+    }
+
+    if (selected && (match_literal(&f->exclude, path) != -1 || match_glob(&f->exclude, path))) {
+        selected = false;
+    }
+
+    return selected;
+}
+
+/*
+ * Decide which files in the package's file list are selected.  On
+ * return *selected holds one flag per file index (free it) and *count
+ * the number selected.  Member names that match nothing are reported
+ * for the package at path.  Returns 0 on success, -1 if any member
+ * name was not found.
+ */
+int
+filter_files(const struct filter *f, rpmfiles files, const char *path, bool **selected, size_t *count)
+{
+    int i = 0;
+    int nfiles = rpmfilesFC(files);
+    int ret = 0;
+    size_t j = 0;
+    char *fn = NULL;
+    bool *seen = NULL;
+
+    assert(f != NULL);
+    assert(selected != NULL);
+    assert(count != NULL);
+
+    *selected = xcalloc((nfiles > 0) ? nfiles : 1, sizeof(**selected));
+    *count = 0;
+    seen = xcalloc(f->members.nliterals ? f->members.nliterals : 1, sizeof(*seen));
+
+    for (i = 0; i < nfiles; i++) {
+        fn = rpmfilesFN(files, i);
+        assert(fn != NULL);
+
+        if (filter_match(f, fn, seen)) {
+            (*selected)[i] = true;
+            (*count)++;
+        }
+
+        free(fn);
+    }
+
+    for (j = 0; j < f->members.nliterals; j++) {
+        if (!seen[j]) {
+            warnx(_("*** %s: %s not found in package"), path, f->members.literals[j]);
+            ret = -1;
+        }
+    }
+
+    free(seen);
+    return ret;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# Copyright The tarpm Project Authors
+# SPDX-License-Identifier: Apache-2.0
+#
+
+#
+# Generate the RPM header tag lookup tables from rpmtag.h.  Each
+# RPMTAG_* enum member becomes a descriptor in tag_table[] holding the
+# symbolic name, the short name librpm reports, and the expected data
+# type and array-ness taken from the type comment on its line:
+#
+#     c  char       h  int16      i  int32      l  int64
+#     s  string     x  binary     s{}  i18n string
+#
+# A trailing [] marks an array.  Members without a type comment have
+# no expected type.  tag_index[] maps a tag number directly to its
+# descriptor; the tag numbers themselves come from the compiler via
+# designated initializers, so expressions such as RPMTAG_SIG_BASE+1
+# need no evaluating here.
+#
+# Usage: gentags.py RPMTAG_H OUTPUT_C
+#
+
+import re
+import sys
+
+TYPES = {
+    "c": "RPM_CHAR_TYPE",
+    "h": "RPM_INT16_TYPE",
+    "i": "RPM_INT32_TYPE",
+    "l": "RPM_INT64_TYPE",
+    "s": "RPM_STRING_TYPE",
+    "x": "RPM_BIN_TYPE",
+    "s[]": "RPM_STRING_ARRAY_TYPE",
+    "s{}": "RPM_I18NSTRING_TYPE",
+}
+
+MEMBER = re.compile(r"^\s*(RPMTAG_\w+)\s*(?:=[^,/]*)?,?\s*(?:/\*\s*(.*?)\*/)?")
+
+
+def parse(path):
+    tags = []
+
+    with open(path) as f:
+        for line in f:
+            m = MEMBER.match(line)
+
+            # aliases are #defines and never match
+            if m is None:
+                continue
+
+            name = m.group(1)
+            comment = (m.group(2) or "").split()
+            token = comment[0] if comment else ""
+            array = False
+
+            if token.endswith("[]") and token != "s[]":
+                token = token[:-2]
+                array = True
+            elif token in ("s[]", "s{}"):
+                array = True
+
+            tags.append((name, TYPES.get(token, "RPM_NULL_TYPE"), array))
+
+    return tags
+
+
+def shortname(name):
+    # librpm's short names: "RPMTAG_NAME" is "Name"
+    tail = name[len("RPMTAG_"):]
+    return tail[0] + tail[1:].lower()
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: %s RPMTAG_H OUTPUT_C\n" % sys.argv[0])
+        return 1
+
+    tags = parse(sys.argv[1])
+
+    with open(sys.argv[2], "w") as out:
+        out.write("/* Generated by gentags.py from rpmtag.h, do not edit. */\n\n")
+        out.write("#include <rpm/rpmtag.h>\n\n")
+        out.write('#include "tarpm.h"\n\n')
+
+        out.write("const struct tagdesc tag_table[] = {\n")
+        out.write("    { NULL, NULL, RPM_NULL_TYPE, false },\n")
+
+        for name, rtype, array in tags:
+            out.write('    { "%s", "%s", %s, %s },\n'
+                      % (name, shortname(name), rtype, "true" if array else "false"))
+
+        out.write("};\n\n")
+
+        out.write("const uint16_t tag_index[] = {\n")
+
+        for i, (name, rtype, array) in enumerate(tags):
+            out.write("    [%s] = %d,\n" % (name, i + 1))
+
+        out.write("};\n\n")
+        out.write("const size_t tag_index_size = sizeof(tag_index) / sizeof(tag_index[0]);\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
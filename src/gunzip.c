@@ -0,0 +1,1247 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Parallel gzip decompression for the payloads of older packages.
+ * Deflate keeps no index of its blocks and any block may copy from the
+ * 32K of output before it, so the stream cannot simply be split.
+ * Instead the compressed payload is cut in to chunks at fixed offsets
+ * and a worker looks for the first bit in its chunk where a deflate
+ * block header is valid, a dynamic Huffman or stored block (fixed
+ * blocks are too easy to match by accident), and decodes from there
+ * without knowing the output before it.  Copies from before the chunk
+ * are kept as markers naming a position in the unknown window.  Each
+ * chunk stops at the first block boundary past the end of its range,
+ * which is where the next chunk should have found its start.  A chunk
+ * gives up once its output passes GZIP_OUTPUT_MAX, eight times its
+ * size and more than most payloads reach, so the memory of every
+ * chunk being decoded can be reserved up front.
+ *
+ * The reader takes the chunks in order.  A chunk that starts where the
+ * one before it stopped has its markers replaced from the last 32K of
+ * output; otherwise the guess was wrong, the chunk had no block
+ * starting in it, or it gave up, and the reader decodes that stretch
+ * itself with the real window.  Further gzip members are decoded the same way.  The
+ * CRC-32 and length in each member's trailer are checked.
+ *
+ * This is the approach of pugz and rapidgzip.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <err.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "tarpm.h"
+
+/* gzip header flags (RFC 1952) */
+#define FHCRC    0x02
+#define FEXTRA   0x04
+#define FNAME    0x08
+#define FCOMMENT 0x10
+
+/* deflate block types (RFC 1951) */
+#define BLOCK_STORED  0
+#define BLOCK_FIXED   1
+#define BLOCK_DYNAMIC 2
+
+#define MAX_CODE_BITS 15
+#define NUM_LITLEN    288
+#define NUM_DIST      32
+#define MAX_MATCH     258
+
+enum chunk_state {
+    CHUNK_QUEUED,
+    CHUNK_DONE,
+    CHUNK_FAILED
+};
+
+/* LSB-first bit reader over the compressed payload. */
+struct bits {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;                    /* next byte to load, may pass len */
+    uint64_t buf;
+    unsigned int n;                /* bits in buf */
+};
+
+/*
+ * Canonical Huffman code.  Codes of up to GZIP_FAST_BITS bits are
+ * looked up in fast, as the symbol shifted left 4 with the code length
+ * in the low bits; longer codes are decoded from count and symbol.
+ */
+struct huffman {
+    uint16_t count[MAX_CODE_BITS + 1];
+    uint16_t symbol[NUM_LITLEN];
+    uint16_t fast[1 << GZIP_FAST_BITS];
+};
+
+/*
+ * Decoded output, as one 16-bit value per byte.  The first
+ * GZIP_WINDOW_SIZE values hold the window: real bytes, or markers
+ * (256 plus the position in the window) when the window is unknown.
+ */
+struct symbols {
+    uint16_t *sym;
+    size_t n;                      /* values used, with the window */
+    size_t size;
+    size_t max;                    /* values it may grow to */
+    size_t floor;                  /* lowest value a copy may read */
+};
+
+/* The block being decoded, which the reader may stop in the middle of. */
+struct gzblock {
+    bool open;                     /* in a block, its header read */
+    bool last;
+    unsigned int type;
+    uint32_t left;                 /* of a stored block, bytes to copy */
+    struct huffman litlen;         /* of a dynamic block */
+    struct huffman dist;
+};
+
+struct gzchunk {
+    uint64_t from;                 /* range to find a block start in, bits */
+    uint64_t to;
+    uint64_t start;                /* where decoding started */
+    uint64_t end;                  /* block boundary where it stopped */
+    bool final;                    /* stopped after the last block */
+    struct symbols out;
+    enum chunk_state state;
+};
+
+struct gunzip {
+    const char *path;
+    const uint8_t *data;
+    size_t len;
+
+    /* chunks, decoded by the workers */
+    struct gzchunk *chunks;
+    size_t nchunks;
+    size_t next;                   /* next chunk for a worker */
+    size_t cur;                    /* chunk the reader is on */
+    size_t inflight;               /* bytes reserved or decoded, not read */
+    bool stop;
+    pthread_t *workers;
+    unsigned int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* the reader */
+    uint64_t expect;               /* where the next block starts, bits */
+    bool serial;                   /* decoding the current range itself */
+    bool members;                  /* past the first member, no chunks */
+    bool finished;                 /* at the end of a member */
+    bool done;
+    uint8_t window[GZIP_WINDOW_SIZE];
+    size_t wlen;                   /* bytes of window known */
+    struct gzblock block;          /* where decoding goes on from */
+    struct symbols scratch;        /* blocks decoded by the reader */
+    uint8_t *res;                  /* output ready to be read */
+    size_t reslen;
+    size_t respos;
+    size_t ressize;
+    uint32_t crc;
+    uint64_t total;
+};
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* order of the code length code lengths in a dynamic block header */
+static const uint8_t code_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static struct huffman fixed_litlen;
+static struct huffman fixed_dist;
+static uint32_t crc_table[8][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static uint32_t
+crc32_update(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    crc = ~crc;
+
+    /* slicing by 8 */
+    while (n >= 8) {
+        a = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+        b = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t) p[7] << 24);
+        crc = crc_table[7][a & 0xff] ^ crc_table[6][(a >> 8) & 0xff] ^ crc_table[5][(a >> 16) & 0xff]
+              ^ crc_table[4][a >> 24] ^ crc_table[3][b & 0xff] ^ crc_table[2][(b >> 8) & 0xff]
+              ^ crc_table[1][(b >> 16) & 0xff] ^ crc_table[0][b >> 24];
+        p += 8;
+        n -= 8;
+    }
+
+    while (n--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+static void
+bits_init(struct bits *b, const uint8_t *data, const size_t len, const uint64_t bitpos)
+{
+    b->data = data;
+    b->len = len;
+    b->pos = bitpos >> 3;
+    b->buf = 0;
+    b->n = 0;
+    return;
+}
+
+/* Top up the bit buffer to at least 56 bits, with zeros past the end. */
+static inline void
+bits_fill(struct bits *b)
+{
+    uint64_t v = 0;
+
+    if (b->pos + 8 <= b->len) {
+        memcpy(&v, b->data + b->pos, sizeof(v));
+        b->buf |= le64toh(v) << b->n;
+        b->pos += (63 - b->n) >> 3;
+        b->n |= 56;
+        return;
+    }
+
+    while (b->n < 56) {
+        b->buf |= (uint64_t) ((b->pos < b->len) ? b->data[b->pos] : 0) << b->n;
+        b->pos++;
+        b->n += 8;
+    }
+
+    return;
+}
+
+static inline uint32_t
+bits_get(struct bits *b, const unsigned int n)
+{
+    uint32_t v = b->buf & ((UINT64_C(1) << n) - 1);
+
+    b->buf >>= n;
+    b->n -= n;
+    return v;
+}
+
+static inline uint64_t
+bits_position(const struct bits *b)
+{
+    return ((uint64_t) b->pos * 8) - b->n;
+}
+
+/* True once reading has gone well past the end of the input. */
+static inline bool
+bits_overrun(const struct bits *b)
+{
+    return b->pos > b->len + 16;
+}
+
+/*
+ * Build a code from the code lengths of n symbols.  Over-subscribed
+ * codes are invalid; incomplete ones only as zlib allows them, a single
+ * code of one bit, and never when complete is set.
+ */
+static bool
+huffman_build(struct huffman *h, const uint8_t *lengths, const unsigned int n, const bool complete)
+{
+    unsigned int i = 0;
+    unsigned int len = 0;
+    unsigned int max = 0;
+    unsigned int reversed = 0;
+    unsigned int k = 0;
+    int left = 1;
+    uint16_t offs[MAX_CODE_BITS + 2];
+    uint16_t next[MAX_CODE_BITS + 1];
+    uint16_t code = 0;
+
+    memset(h->count, 0, sizeof(h->count));
+
+    for (i = 0; i < n; i++) {
+        h->count[lengths[i]]++;
+        max = (lengths[i] > max) ? lengths[i] : max;
+    }
+
+    h->count[0] = 0;
+
+    for (len = 1; len <= MAX_CODE_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    if (left > 0 && (complete || max > 1)) {
+        return false;
+    }
+
+    /* symbols in code order */
+    offs[1] = 0;
+
+    for (len = 1; len <= MAX_CODE_BITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+
+    for (i = 0; i < n; i++) {
+        if (lengths[i] != 0) {
+            h->symbol[offs[lengths[i]]++] = i;
+        }
+    }
+
+    /* canonical codes, reversed because deflate sends them MSB first */
+    for (len = 1; len <= MAX_CODE_BITS; len++) {
+        code = (code + h->count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    memset(h->fast, 0, sizeof(h->fast));
+
+    for (i = 0; i < n; i++) {
+        len = lengths[i];
+
+        if (len == 0 || len > GZIP_FAST_BITS) {
+            if (len != 0) {
+                next[len]++;
+            }
+
+            continue;
+        }
+
+        code = next[len]++;
+        reversed = 0;
+
+        for (k = 0; k < len; k++) {
+            reversed = (reversed << 1) | ((code >> k) & 1);
+        }
+
+        for (; reversed < (1U << GZIP_FAST_BITS); reversed += 1U << len) {
+            h->fast[reversed] = (i << 4) | len;
+        }
+    }
+
+    return true;
+}
+
+/* Decode a code longer than the fast table covers, one bit at a time. */
+static int
+huffman_slow(const struct huffman *h, struct bits *b)
+{
+    unsigned int len = 0;
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    int count = 0;
+    uint64_t buf = b->buf;
+
+    for (len = 1; len <= MAX_CODE_BITS; len++) {
+        code |= buf & 1;
+        buf >>= 1;
+        count = h->count[len];
+
+        if (code - count < first) {
+            bits_get(b, len);
+            return h->symbol[index + (code - first)];
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+/* Decode a symbol.  The bit buffer must hold at least 15 bits. */
+static inline int
+huffman_decode(const struct huffman *h, struct bits *b)
+{
+    uint16_t e = h->fast[b->buf & ((1U << GZIP_FAST_BITS) - 1)];
+
+    if (e != 0) {
+        bits_get(b, e & 15);
+        return e >> 4;
+    }
+
+    return huffman_slow(h, b);
+}
+
+static void
+tables_init(void)
+{
+    uint8_t lengths[NUM_LITLEN];
+    uint32_t c = 0;
+    unsigned int i = 0;
+    unsigned int k = 0;
+
+    for (i = 0; i < NUM_LITLEN; i++) {
+        lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+    }
+
+    huffman_build(&fixed_litlen, lengths, NUM_LITLEN, true);
+
+    /* all 32 distance codes, so the code is complete; 30 and 31 are invalid */
+    memset(lengths, 5, NUM_DIST);
+    huffman_build(&fixed_dist, lengths, NUM_DIST, true);
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+
+        crc_table[0][i] = c;
+    }
+
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 8; k++) {
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xff];
+        }
+    }
+
+    return;
+}
+
+/* Make room for n more values.  Returns false past o->max. */
+static inline bool
+symbols_reserve(struct symbols *o, const size_t n)
+{
+    size_t size = 0;
+
+    if (o->n + n <= o->size) {
+        return true;
+    }
+
+    if (o->n + n > o->max) {
+        return false;
+    }
+
+    size = o->size * 2;
+    size = (size < o->n + n) ? o->n + n : size;
+    size = (size > o->max) ? o->max : size;
+    o->sym = xrealloc(o->sym, size * sizeof(*o->sym));
+    o->size = size;
+    return true;
+}
+
+/* Read the code lengths of a dynamic block and build its codes. */
+static bool
+read_dynamic(struct bits *b, struct huffman *litlen, struct huffman *dist)
+{
+    struct huffman codes;
+    uint8_t lengths[286 + 30];
+    uint8_t cl[19];
+    unsigned int nlen = 0;
+    unsigned int ndist = 0;
+    unsigned int ncode = 0;
+    unsigned int i = 0;
+    unsigned int rep = 0;
+    uint8_t val = 0;
+    int sym = 0;
+
+    bits_fill(b);
+    nlen = bits_get(b, 5) + 257;
+    ndist = bits_get(b, 5) + 1;
+    ncode = bits_get(b, 4) + 4;
+
+    if (nlen > 286 || ndist > 30) {
+        return false;
+    }
+
+    memset(cl, 0, sizeof(cl));
+
+    for (i = 0; i < ncode; i++) {
+        bits_fill(b);
+        cl[code_order[i]] = bits_get(b, 3);
+    }
+
+    if (!huffman_build(&codes, cl, 19, true)) {
+        return false;
+    }
+
+    i = 0;
+
+    while (i < nlen + ndist) {
+        bits_fill(b);
+
+        if ((sym = huffman_decode(&codes, b)) < 0) {
+            return false;
+        }
+
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+
+        val = 0;
+
+        if (sym == 16) {
+            if (i == 0) {
+                return false;
+            }
+
+            val = lengths[i - 1];
+            rep = 3 + bits_get(b, 2);
+        } else if (sym == 17) {
+            rep = 3 + bits_get(b, 3);
+        } else {
+            rep = 11 + bits_get(b, 7);
+        }
+
+        if (i + rep > nlen + ndist) {
+            return false;
+        }
+
+        memset(lengths + i, val, rep);
+        i += rep;
+    }
+
+    /* a block must be able to end */
+    if (lengths[256] == 0) {
+        return false;
+    }
+
+    return huffman_build(litlen, lengths, nlen, false) && huffman_build(dist, lengths + nlen, ndist, false);
+}
+
+/*
+ * Decode the symbols of a Huffman block up to its end of block code,
+ * or until there are limit values.  Returns 1 at the end of the block,
+ * 0 if stopped at limit, or -1 if the data is not valid.
+ */
+static int
+inflate_codes(struct bits *b, const struct huffman *litlen, const struct huffman *dist, struct symbols *o, const size_t limit)
+{
+    int sym = 0;
+    unsigned int len = 0;
+    unsigned int d = 0;
+    unsigned int i = 0;
+    uint16_t *src = NULL;
+    uint16_t *dst = NULL;
+
+    while (o->n < limit) {
+        /* room for the longest code, length, distance, and extra bits */
+        bits_fill(b);
+
+        if (bits_overrun(b) || (sym = huffman_decode(litlen, b)) < 0) {
+            return -1;
+        }
+
+        if (sym < 256) {
+            if (!symbols_reserve(o, 1)) {
+                return -1;
+            }
+
+            o->sym[o->n++] = sym;
+            continue;
+        } else if (sym == 256) {
+            return 1;
+        }
+
+        sym -= 257;
+
+        if (sym >= 29) {
+            return -1;
+        }
+
+        len = length_base[sym] + bits_get(b, length_extra[sym]);
+
+        if ((sym = huffman_decode(dist, b)) < 0 || sym >= 30) {
+            return -1;
+        }
+
+        d = dist_base[sym] + bits_get(b, dist_extra[sym]);
+
+        if (d > o->n - o->floor || !symbols_reserve(o, len)) {
+            return -1;
+        }
+
+        /* overlapping copies repeat the last d values */
+        dst = o->sym + o->n;
+        src = dst - d;
+
+        for (i = 0; i < len; i++) {
+            dst[i] = src[i];
+        }
+
+        o->n += len;
+    }
+
+    return 0;
+}
+
+/* Read the lengths at the start of a stored block. */
+static bool
+stored_header(struct bits *b, struct gzblock *blk)
+{
+    uint32_t nlen = 0;
+
+    /* to the byte boundary */
+    bits_get(b, b->n & 7);
+    bits_fill(b);
+    blk->left = bits_get(b, 16);
+    nlen = bits_get(b, 16);
+    return blk->left == (~nlen & 0xffff);
+}
+
+/*
+ * Copy what is left of a stored block, up to limit values.  Returns 1
+ * at the end of the block, 0 if stopped at limit, or -1 if the block
+ * runs past the input.
+ */
+static int
+inflate_stored(struct bits *b, struct symbols *o, const size_t limit, struct gzblock *blk)
+{
+    size_t at = b->pos - (b->n / 8);
+    size_t len = blk->left;
+    size_t i = 0;
+
+    if (o->n >= limit) {
+        len = 0;
+    } else if (len > limit - o->n) {
+        len = limit - o->n;
+    }
+
+    if (at > b->len || blk->left > b->len - at || !symbols_reserve(o, len)) {
+        return -1;
+    }
+
+    for (i = 0; i < len; i++) {
+        o->sym[o->n + i] = b->data[at + i];
+    }
+
+    o->n += len;
+    blk->left -= len;
+    bits_init(b, b->data, b->len, (uint64_t) (at + len) * 8);
+    return (blk->left == 0) ? 1 : 0;
+}
+
+/*
+ * Decode blocks starting at bit start until the first block boundary
+ * at or past bit stop, or after the last block.  Once there are
+ * stop_out values decoding stops, in the middle of a block if need
+ * be, which is left open in blk to go on with from *end.  Otherwise
+ * *end is the block boundary and *final says whether it follows the
+ * last block.  Returns false if the data is not valid deflate.
+ */
+static bool
+inflate_run(const uint8_t *data, const size_t len, const uint64_t start, const uint64_t stop, const size_t stop_out,
+            struct symbols *o, struct gzblock *blk, uint64_t *end, bool *final)
+{
+    struct bits b;
+    uint64_t pos = start;
+    int rc = 0;
+
+    bits_init(&b, data, len, start);
+    bits_fill(&b);
+    bits_get(&b, start & 7);
+
+    do {
+        if (!blk->open) {
+            bits_fill(&b);
+            blk->last = bits_get(&b, 1);
+            blk->type = bits_get(&b, 2);
+            blk->open = true;
+
+            if ((blk->type == BLOCK_STORED && !stored_header(&b, blk))
+                || (blk->type == BLOCK_DYNAMIC && !read_dynamic(&b, &blk->litlen, &blk->dist)) || blk->type > BLOCK_DYNAMIC) {
+                return false;
+            }
+        }
+
+        switch (blk->type) {
+            case BLOCK_STORED:
+                rc = inflate_stored(&b, o, stop_out, blk);
+                break;
+            case BLOCK_FIXED:
+                rc = inflate_codes(&b, &fixed_litlen, &fixed_dist, o, stop_out);
+                break;
+            default:
+                rc = inflate_codes(&b, &blk->litlen, &blk->dist, o, stop_out);
+                break;
+        }
+
+        pos = bits_position(&b);
+
+        if (rc == -1 || pos > (uint64_t) len * 8) {
+            return false;
+        }
+
+        blk->open = (rc == 0);
+    } while (!blk->open && !blk->last && pos < stop);
+
+    *end = pos;
+    *final = !blk->open && blk->last;
+    return true;
+}
+
+/* Up to 64 bits of the input from bit pos, zeros past the end. */
+static uint64_t
+peek_bits(const uint8_t *data, const size_t len, const uint64_t pos)
+{
+    size_t at = pos >> 3;
+    size_t i = 0;
+    uint64_t v = 0;
+
+    if (at + 8 <= len) {
+        memcpy(&v, data + at, sizeof(v));
+        v = le64toh(v);
+    } else {
+        for (i = 0; at + i < len && i < 8; i++) {
+            v |= (uint64_t) data[at + i] << (8 * i);
+        }
+    }
+
+    return v >> (pos & 7);
+}
+
+/*
+ * Cheap test for whether a dynamic or stored block could start at bit
+ * pos: field ranges, a complete code length code, or matching stored
+ * lengths.  Most positions fail here without building any code.
+ */
+static bool
+block_candidate(const uint8_t *data, const size_t len, const uint64_t pos)
+{
+    uint64_t v = peek_bits(data, len, pos);
+    unsigned int ncode = 0;
+    unsigned int i = 0;
+    unsigned int l = 0;
+    int left = 1 << 7;
+    size_t at = 0;
+
+    if (((v >> 1) & 3) == BLOCK_STORED) {
+        at = (pos + 3 + 7) >> 3;
+        return at + 4 <= len && (data[at] | (data[at + 1] << 8)) == (~(data[at + 2] | (data[at + 3] << 8)) & 0xffff);
+    }
+
+    if (((v >> 1) & 3) != BLOCK_DYNAMIC || ((v >> 3) & 31) > 29 || ((v >> 8) & 31) > 29) {
+        return false;
+    }
+
+    ncode = ((v >> 13) & 15) + 4;
+    v = peek_bits(data, len, pos + 17);
+
+    for (i = 0; i < ncode; i++) {
+        l = (v >> (3 * i)) & 7;
+
+        if (l != 0 && (left -= 1 << (7 - l)) < 0) {
+            return false;
+        }
+    }
+
+    return left == 0;
+}
+
+/*
+ * Start an output with a window of markers, or no window at all, room
+ * for size values, and up to max.
+ */
+static void
+symbols_start(struct symbols *o, const size_t size, const size_t max, const bool window)
+{
+    size_t i = 0;
+
+    o->max = GZIP_WINDOW_SIZE + max;
+    o->size = GZIP_WINDOW_SIZE + ((size < max) ? size : max);
+    o->sym = xrealloc(o->sym, o->size * sizeof(*o->sym));
+    o->n = GZIP_WINDOW_SIZE;
+    o->floor = window ? 0 : GZIP_WINDOW_SIZE;
+
+    for (i = 0; window && i < GZIP_WINDOW_SIZE; i++) {
+        o->sym[i] = 256 + i;
+    }
+
+    return;
+}
+
+/*
+ * Decode a chunk on a worker.  The first chunk starts at the start of
+ * the stream; the others try each candidate block start in their range
+ * until one decodes cleanly to the end of the range.  Returns the state
+ * for the worker to publish.
+ */
+static enum chunk_state
+chunk_decode(const struct gunzip *g, struct gzchunk *c, const bool first)
+{
+    struct gzblock blk;
+    uint64_t pos = 0;
+
+    symbols_start(&c->out, 4 * ((c->to - c->from) / 8), GZIP_OUTPUT_MAX, !first);
+
+    for (pos = c->from; pos < c->to; pos++) {
+        if (!first && !block_candidate(g->data, g->len, pos)) {
+            continue;
+        }
+
+        c->out.n = GZIP_WINDOW_SIZE;
+        blk.open = false;
+
+        if (inflate_run(g->data, g->len, pos, c->to, SIZE_MAX, &c->out, &blk, &c->end, &c->final)) {
+            c->start = pos;
+            return CHUNK_DONE;
+        }
+
+        if (first) {
+            break;
+        }
+    }
+
+    free(c->out.sym);
+    memset(&c->out, 0, sizeof(c->out));
+    return CHUNK_FAILED;
+}
+
+static void *
+chunk_worker(void *arg)
+{
+    struct gunzip *g = arg;
+    struct gzchunk *c = NULL;
+    enum chunk_state state = CHUNK_QUEUED;
+    size_t i = 0;
+
+    pthread_mutex_lock(&g->lock);
+
+    while (1) {
+        /*
+         * Stay a bounded distance ahead of the reader, with room for
+         * the largest output a chunk can have reserved before it is
+         * claimed, so memory stays bounded however many workers run.
+         * The chunk being read is always claimed.
+         */
+        while (!g->stop && g->next < g->nchunks && g->next != g->cur
+               && (g->next >= g->cur + (2 * g->nworkers) || g->inflight + GZIP_CHUNK_RESERVE > DECODER_INFLIGHT_MAX)) {
+            pthread_cond_wait(&g->cond, &g->lock);
+        }
+
+        if (g->stop || g->next >= g->nchunks) {
+            break;
+        }
+
+        i = g->next++;
+        c = &g->chunks[i];
+        g->inflight += GZIP_CHUNK_RESERVE;
+        pthread_mutex_unlock(&g->lock);
+
+        state = chunk_decode(g, c, i == 0);
+
+        /* then only what the chunk really holds, before it is read */
+        pthread_mutex_lock(&g->lock);
+        g->inflight -= GZIP_CHUNK_RESERVE;
+        g->inflight += c->out.size * sizeof(*c->out.sym);
+        c->state = state;
+        pthread_cond_broadcast(&g->cond);
+    }
+
+    pthread_mutex_unlock(&g->lock);
+    return NULL;
+}
+
+/*
+ * Parse a gzip member header at data.  Returns the offset of the
+ * deflate stream, or 0 if it is not a valid header.
+ */
+static size_t
+gzip_header(const uint8_t *data, const size_t len)
+{
+    size_t at = 10;
+    uint8_t flags = 0;
+
+    if (len < 18 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 || (data[3] & 0xe0)) {
+        return 0;
+    }
+
+    flags = data[3];
+
+    if (flags & FEXTRA) {
+        at += 2 + (data[at] | (data[at + 1] << 8));
+    }
+
+    if (flags & FNAME) {
+        while (at < len && data[at] != '\0') {
+            at++;
+        }
+
+        at++;
+    }
+
+    if (flags & FCOMMENT) {
+        while (at < len && data[at] != '\0') {
+            at++;
+        }
+
+        at++;
+    }
+
+    if (flags & FHCRC) {
+        at += 2;
+    }
+
+    return (at < len) ? at : 0;
+}
+
+/* Account for n bytes of output now in g->res. */
+static void
+output_ready(struct gunzip *g, const size_t n)
+{
+    g->reslen = n;
+    g->respos = 0;
+    g->crc = crc32_update(g->crc, g->res, n);
+    g->total += n;
+
+    /* keep the last 32K for what comes next */
+    if (n >= GZIP_WINDOW_SIZE) {
+        memcpy(g->window, g->res + n - GZIP_WINDOW_SIZE, GZIP_WINDOW_SIZE);
+        g->wlen = GZIP_WINDOW_SIZE;
+    } else {
+        memmove(g->window, g->window + n, GZIP_WINDOW_SIZE - n);
+        memcpy(g->window + GZIP_WINDOW_SIZE - n, g->res, n);
+        g->wlen = (g->wlen + n > GZIP_WINDOW_SIZE) ? GZIP_WINDOW_SIZE : g->wlen + n;
+    }
+
+    return;
+}
+
+/*
+ * Turn decoded values in to bytes in g->res, replacing markers with
+ * the window.  Returns false if a marker reaches back past the start
+ * of the stream.
+ */
+static bool
+resolve(struct gunzip *g, const struct symbols *o)
+{
+    size_t n = o->n - GZIP_WINDOW_SIZE;
+    size_t i = 0;
+    size_t lowest = GZIP_WINDOW_SIZE - g->wlen;
+    uint16_t v = 0;
+
+    if (n > g->ressize) {
+        g->res = xrealloc(g->res, n);
+        g->ressize = n;
+    }
+
+    for (i = 0; i < n; i++) {
+        v = o->sym[GZIP_WINDOW_SIZE + i];
+
+        if (v < 256) {
+            g->res[i] = v;
+        } else if ((size_t) (v - 256) >= lowest) {
+            g->res[i] = g->window[v - 256];
+        } else {
+            return false;
+        }
+    }
+
+    output_ready(g, n);
+    return true;
+}
+
+/* Let the workers have the memory of the chunk the reader is on. */
+static void
+release_chunk(struct gunzip *g)
+{
+    struct gzchunk *c = &g->chunks[g->cur];
+
+    pthread_mutex_lock(&g->lock);
+
+    while (c->state == CHUNK_QUEUED) {
+        pthread_cond_wait(&g->cond, &g->lock);
+    }
+
+    g->inflight -= c->out.size * sizeof(*c->out.sym);
+    free(c->out.sym);
+    memset(&c->out, 0, sizeof(c->out));
+    g->cur++;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+    return;
+}
+
+/*
+ * Decode from g->expect on this thread, with the real window, up to
+ * the first block boundary at or past bit stop or a few megabytes of
+ * output, which may end in the middle of a block.  Returns 0 on
+ * success, -1 if the data is bad.
+ */
+static int
+decode_serial(struct gunzip *g, const uint64_t stop)
+{
+    struct symbols *o = &g->scratch;
+    size_t i = 0;
+
+    /* a copy may end up to a match past where decoding stops */
+    symbols_start(o, GZIP_SERIAL_OUTPUT, GZIP_SERIAL_OUTPUT + MAX_MATCH, false);
+    o->floor = GZIP_WINDOW_SIZE - g->wlen;
+
+    for (i = o->floor; i < GZIP_WINDOW_SIZE; i++) {
+        o->sym[i] = g->window[i];
+    }
+
+    if (!inflate_run(g->data, g->len, g->expect, stop, GZIP_WINDOW_SIZE + GZIP_SERIAL_OUTPUT, o, &g->block, &g->expect, &g->finished)
+        || !resolve(g, o)) {
+        warnx(_("*** %s: damaged gzip payload near offset %llu"), g->path, (unsigned long long) (g->expect / 8));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Check the trailer of the member that just ended and move to the
+ * next member if there is one.  Returns 1 if there is, 0 at the end
+ * of the payload, or -1 on error.
+ */
+static int
+finish_member(struct gunzip *g)
+{
+    size_t at = (g->expect + 7) / 8;
+    size_t start = 0;
+    uint32_t crc = 0;
+    uint32_t isize = 0;
+
+    if (at + 8 > g->len) {
+        warnx(_("*** %s: truncated gzip payload"), g->path);
+        return -1;
+    }
+
+    memcpy(&crc, g->data + at, sizeof(crc));
+    memcpy(&isize, g->data + at + 4, sizeof(isize));
+
+    if (le32toh(crc) != g->crc || le32toh(isize) != (uint32_t) g->total) {
+        warnx(_("*** %s: gzip payload CRC or length mismatch"), g->path);
+        return -1;
+    }
+
+    at += 8;
+
+    /* anything after the last member is ignored, as gzip does */
+    if (at + 2 > g->len || g->data[at] != 0x1f || g->data[at + 1] != 0x8b) {
+        g->done = true;
+        return 0;
+    }
+
+    if ((start = gzip_header(g->data + at, g->len - at)) == 0) {
+        warnx(_("*** %s: damaged gzip member header at offset %zu"), g->path, at);
+        return -1;
+    }
+
+    /* later members are decoded here, the workers are not needed */
+    pthread_mutex_lock(&g->lock);
+    g->stop = true;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+
+    g->expect = (uint64_t) (at + start) * 8;
+    g->members = true;
+    g->finished = false;
+    g->wlen = 0;
+    g->crc = 0;
+    g->total = 0;
+    return 1;
+}
+
+/*
+ * Make the next stretch of output ready in g->res.  Returns 1 if there
+ * is more (possibly empty), 0 at the end, or -1 on error.
+ */
+static int
+next_output(struct gunzip *g)
+{
+    struct gzchunk *c = NULL;
+
+    g->reslen = 0;
+    g->respos = 0;
+
+    if (g->done) {
+        return 0;
+    } else if (g->finished) {
+        return finish_member(g);
+    } else if (g->members) {
+        return (decode_serial(g, UINT64_MAX) == -1) ? -1 : 1;
+    }
+
+    /* chunks already covered by decoding here */
+    while (g->cur < g->nchunks && g->expect >= g->chunks[g->cur].to) {
+        g->serial = false;
+        release_chunk(g);
+    }
+
+    if (g->cur >= g->nchunks) {
+        warnx(_("*** %s: truncated gzip payload"), g->path);
+        return -1;
+    }
+
+    c = &g->chunks[g->cur];
+
+    if (!g->serial) {
+        pthread_mutex_lock(&g->lock);
+
+        while (c->state == CHUNK_QUEUED) {
+            pthread_cond_wait(&g->cond, &g->lock);
+        }
+
+        pthread_mutex_unlock(&g->lock);
+
+        if (c->state == CHUNK_DONE && c->start == g->expect && !g->block.open) {
+            if (!resolve(g, &c->out)) {
+                warnx(_("*** %s: damaged gzip payload near offset %llu"), g->path, (unsigned long long) (c->start / 8));
+                return -1;
+            }
+
+            g->expect = c->end;
+            g->finished = c->final;
+            release_chunk(g);
+            return 1;
+        }
+
+        /* the guess for this chunk was wrong, decode it here */
+        g->serial = true;
+    }
+
+    return (decode_serial(g, c->to) == -1) ? -1 : 1;
+}
+
+/*
+ * Start decompressing the gzip payload at data with up to threads
+ * worker threads.  Returns NULL if it is not a gzip stream or is too
+ * small to be worth splitting.
+ */
+struct gunzip *
+gunzip_open(const char *path, const uint8_t *data, const size_t len, const unsigned int threads)
+{
+    struct gunzip *g = NULL;
+    size_t start = 0;
+    size_t i = 0;
+
+    assert(path != NULL);
+
+    if ((start = gzip_header(data, len)) == 0 || (len - start) / GZIP_CHUNK_SIZE < 2 || threads < 2) {
+        return NULL;
+    }
+
+    pthread_once(&tables_once, tables_init);
+
+    g = xalloc(sizeof(*g));
+    g->path = path;
+    g->data = data;
+    g->len = len;
+    g->expect = (uint64_t) start * 8;
+
+    /* the last chunk takes the remainder */
+    g->nchunks = (len - start) / GZIP_CHUNK_SIZE;
+    g->chunks = xcalloc(g->nchunks, sizeof(*g->chunks));
+
+    for (i = 0; i < g->nchunks; i++) {
+        g->chunks[i].from = (uint64_t) (start + (i * GZIP_CHUNK_SIZE)) * 8;
+        g->chunks[i].to = (i + 1 < g->nchunks) ? (uint64_t) (start + ((i + 1) * GZIP_CHUNK_SIZE)) * 8 : (uint64_t) len * 8;
+    }
+
+    g->nworkers = (threads > g->nchunks) ? g->nchunks : threads;
+    g->workers = xcalloc(g->nworkers, sizeof(*g->workers));
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->cond, NULL);
+
+    for (i = 0; i < g->nworkers; i++) {
+        if (pthread_create(&g->workers[i], NULL, chunk_worker, g) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    return g;
+}
+
+/*
+ * Read up to len bytes of decompressed output in to buf.  Returns the
+ * number of bytes read, 0 at the end, or -1 on error.
+ */
+ssize_t
+gunzip_read(struct gunzip *g, void *buf, const size_t len)
+{
+    size_t got = 0;
+    size_t n = 0;
+    int rc = 0;
+
+    assert(g != NULL);
+
+    while (got < len) {
+        if (g->respos == g->reslen) {
+            if ((rc = next_output(g)) <= 0) {
+                return (rc == -1) ? -1 : (ssize_t) got;
+            }
+
+            continue;
+        }
+
+        n = g->reslen - g->respos;
+        n = (n > len - got) ? len - got : n;
+        memcpy((uint8_t *) buf + got, g->res + g->respos, n);
+        g->respos += n;
+        got += n;
+    }
+
+    return got;
+}
+
+/* Offset in the input up to which it has been decoded. */
+size_t
+gunzip_position(const struct gunzip *g)
+{
+    assert(g != NULL);
+
+    return g->expect / 8;
+}
+
+void
+gunzip_close(struct gunzip *g)
+{
+    unsigned int i = 0;
+    size_t j = 0;
+
+    if (g == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&g->lock);
+    g->stop = true;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+
+    for (i = 0; i < g->nworkers; i++) {
+        pthread_join(g->workers[i], NULL);
+    }
+
+    for (j = 0; j < g->nchunks; j++) {
+        free(g->chunks[j].out.sym);
+    }
+
+    pthread_cond_destroy(&g->cond);
+    pthread_mutex_destroy(&g->lock);
+    free(g->chunks);
+    free(g->workers);
+    free(g->scratch.sym);
+    free(g->res);
+    free(g);
+    return;
+}
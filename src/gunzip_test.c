@@ -0,0 +1,469 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Round trip test for gunzip.c.  Gzip streams are written here with
+ * stored, fixed, and dynamic Huffman blocks, including one block with
+ * more output than the reader decodes at a time, and a second member,
+ * then read back through gunzip_read() and compared with what went
+ * in.  A payload under the two-chunk minimum must be left to rpmio,
+ * and a damaged trailer must be reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <err.h>
+
+#include "tarpm.h"
+
+/* how much of each kind of block the first member holds */
+#define TEST_DYNAMIC_SIZE  (2 * 1024 * 1024)
+#define TEST_STORED_SIZE   (2 * 1024 * 1024)
+#define TEST_FIXED_SIZE    (1024 * 1024)
+#define TEST_RUN_SIZE      ((size_t) 24 * 1024 * 1024)
+
+/* a deflate stream and the bytes it decompresses to */
+struct stream {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    uint64_t buf;                  /* bits not yet in data */
+    unsigned int n;
+    uint8_t *out;
+    size_t outlen;
+    size_t outsize;
+};
+
+/* canonical Huffman code for a block, as codes and their lengths */
+struct code {
+    uint16_t code[288];
+    uint8_t len[288];
+};
+
+/* order of the code length code lengths in a dynamic block header */
+static const uint8_t code_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static struct code fixed_litlen;
+static struct code fixed_dist;
+static struct code dyn_litlen;
+static struct code dyn_dist;
+static struct code dyn_lengths;
+static uint64_t seed = 0x9e3779b97f4a7c15;
+
+static uint8_t
+random_byte(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed >> 24;
+}
+
+static uint32_t
+crc32(uint32_t crc, const uint8_t *p, size_t n)
+{
+    unsigned int k = 0;
+
+    crc = ~crc;
+
+    while (n--) {
+        crc ^= *p++;
+
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+/* Write the low n bits of v, least significant first. */
+static void
+put_bits(struct stream *s, const uint32_t v, const unsigned int n)
+{
+    s->buf |= (uint64_t) v << s->n;
+    s->n += n;
+
+    while (s->n >= 8) {
+        if (s->len == s->size) {
+            s->size = s->size ? s->size * 2 : 65536;
+            s->data = xrealloc(s->data, s->size);
+        }
+
+        s->data[s->len++] = s->buf & 0xff;
+        s->buf >>= 8;
+        s->n -= 8;
+    }
+
+    return;
+}
+
+/* Write a Huffman code, which deflate sends most significant bit first. */
+static void
+put_code(struct stream *s, const struct code *c, const unsigned int sym)
+{
+    uint32_t reversed = 0;
+    unsigned int i = 0;
+
+    assert(c->len[sym] != 0);
+
+    for (i = 0; i < c->len[sym]; i++) {
+        reversed = (reversed << 1) | ((c->code[sym] >> i) & 1);
+    }
+
+    put_bits(s, reversed, c->len[sym]);
+    return;
+}
+
+static void
+align(struct stream *s)
+{
+    if (s->n & 7) {
+        put_bits(s, 0, 8 - (s->n & 7));
+    }
+
+    return;
+}
+
+static void
+put_bytes(struct stream *s, const uint8_t *p, const size_t n)
+{
+    size_t i = 0;
+
+    for (i = 0; i < n; i++) {
+        put_bits(s, p[i], 8);
+    }
+
+    return;
+}
+
+/* Record n bytes the stream decompresses to. */
+static void
+expect(struct stream *s, const uint8_t *p, const size_t n)
+{
+    if (s->outlen + n > s->outsize) {
+        s->outsize = (s->outlen + n) * 2;
+        s->out = xrealloc(s->out, s->outsize);
+    }
+
+    memcpy(s->out + s->outlen, p, n);
+    s->outlen += n;
+    return;
+}
+
+static void
+code_build(struct code *c, const uint8_t *lengths, const unsigned int n)
+{
+    uint16_t count[16];
+    uint16_t next[16];
+    uint16_t code = 0;
+    unsigned int i = 0;
+
+    memset(c, 0, sizeof(*c));
+    memset(count, 0, sizeof(count));
+
+    for (i = 0; i < n; i++) {
+        count[lengths[i]]++;
+    }
+
+    count[0] = 0;
+
+    for (i = 1; i < 16; i++) {
+        code = (code + count[i - 1]) << 1;
+        next[i] = code;
+    }
+
+    for (i = 0; i < n; i++) {
+        c->len[i] = lengths[i];
+
+        if (lengths[i] != 0) {
+            c->code[i] = next[lengths[i]]++;
+        }
+    }
+
+    return;
+}
+
+static void
+codes_init(void)
+{
+    uint8_t lengths[288];
+    unsigned int i = 0;
+
+    for (i = 0; i < 288; i++) {
+        lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+    }
+
+    code_build(&fixed_litlen, lengths, 288);
+    memset(lengths, 5, 30);
+    code_build(&fixed_dist, lengths, 30);
+
+    /* 9 bits for a literal, 6 or 5 for the rest, two distances */
+    for (i = 0; i < 286; i++) {
+        lengths[i] = (i < 256) ? 9 : (i < 284) ? 6 : 5;
+    }
+
+    code_build(&dyn_litlen, lengths, 286);
+    memset(lengths, 1, 2);
+    code_build(&dyn_dist, lengths, 2);
+
+    /* the code lengths above and 16, to repeat the one before */
+    memset(lengths, 0, 19);
+    lengths[1] = 3;
+    lengths[5] = 2;
+    lengths[6] = 2;
+    lengths[9] = 2;
+    lengths[16] = 3;
+    code_build(&dyn_lengths, lengths, 19);
+    return;
+}
+
+static void
+gzip_header(struct stream *s)
+{
+    static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+
+    put_bytes(s, header, sizeof(header));
+    return;
+}
+
+/* End the member that started at byte start of the output. */
+static void
+gzip_trailer(struct stream *s, const size_t start)
+{
+    uint32_t crc = crc32(0, s->out + start, s->outlen - start);
+
+    align(s);
+    put_bits(s, crc & 0xffff, 16);
+    put_bits(s, crc >> 16, 16);
+    put_bits(s, (s->outlen - start) & 0xffff, 16);
+    put_bits(s, ((s->outlen - start) >> 16) & 0xffff, 16);
+    return;
+}
+
+/* Stored blocks of n random bytes. */
+static void
+stored_blocks(struct stream *s, size_t n, const bool last)
+{
+    uint8_t block[65535];
+    size_t len = 0;
+    size_t i = 0;
+
+    while (n > 0) {
+        len = (n > sizeof(block)) ? sizeof(block) : n;
+
+        for (i = 0; i < len; i++) {
+            block[i] = random_byte();
+        }
+
+        put_bits(s, last && len == n, 1);
+        put_bits(s, 0, 2);
+        align(s);
+        put_bits(s, len, 16);
+        put_bits(s, ~len & 0xffff, 16);
+        put_bytes(s, block, len);
+        expect(s, block, len);
+        n -= len;
+    }
+
+    return;
+}
+
+/*
+ * A fixed or dynamic block of n random letters, with a copy of length
+ * 3 from distance 2 in every eighth place, then a run of at least run
+ * more of the last byte, copied 258 at a time from distance 1.
+ */
+static void
+huffman_block(struct stream *s, const bool dynamic, size_t n, size_t run, const bool last)
+{
+    const struct code *litlen = dynamic ? &dyn_litlen : &fixed_litlen;
+    const struct code *dist = dynamic ? &dyn_dist : &fixed_dist;
+    uint8_t b[3];
+    size_t len = 0;
+    size_t i = 0;
+
+    put_bits(s, last, 1);
+    put_bits(s, dynamic ? 2 : 1, 2);
+
+    if (dynamic) {
+        /* 286 lengths, 2 distances, and code lengths up to that of 1 */
+        put_bits(s, 286 - 257, 5);
+        put_bits(s, 2 - 1, 5);
+        put_bits(s, 18 - 4, 4);
+
+        for (i = 0; i < 18; i++) {
+            put_bits(s, dyn_lengths.len[code_order[i]], 3);
+        }
+
+        /* the 256 literals: one 9, then 16 repeating it 42 * 6 + 3 times */
+        put_code(s, &dyn_lengths, 9);
+
+        for (i = 0; i < 43; i++) {
+            put_code(s, &dyn_lengths, 16);
+            put_bits(s, (i < 42) ? 3 : 0, 2);
+        }
+
+        for (i = 256; i < 286; i++) {
+            put_code(s, &dyn_lengths, dyn_litlen.len[i]);
+        }
+
+        put_code(s, &dyn_lengths, 1);
+        put_code(s, &dyn_lengths, 1);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (i % 8 == 7 && i >= 2) {
+            len = (n - i < 3) ? n - i : 3;
+            b[0] = s->out[s->outlen - 2];
+            b[1] = s->out[s->outlen - 1];
+
+            if (len == 3) {
+                /* length 3, distance 2: the last two bytes, then the first again */
+                put_code(s, litlen, 257);
+                put_code(s, dist, 1);
+                b[2] = b[0];
+                expect(s, b, 3);
+                i += 2;
+                continue;
+            }
+        }
+
+        b[0] = 'a' + (random_byte() % 26);
+        put_code(s, litlen, b[0]);
+        expect(s, b, 1);
+    }
+
+    /* length 258 from distance 1 */
+    memset(b, s->out[s->outlen - 1], sizeof(b));
+
+    for (i = 0; i < run; i += 258) {
+        put_code(s, litlen, 285);
+        put_code(s, dist, 0);
+
+        for (len = 0; len < 258; len += 3) {
+            expect(s, b, 3);
+        }
+    }
+
+    put_code(s, litlen, 256);
+    return;
+}
+
+static void
+stream_free(struct stream *s)
+{
+    free(s->data);
+    free(s->out);
+    memset(s, 0, sizeof(*s));
+    return;
+}
+
+/*
+ * Decompress s with threads workers, reading size bytes at a time.
+ * Returns 0 if the output matches, -1 otherwise.
+ */
+static int
+round_trip(const char *name, const struct stream *s, const unsigned int threads, const size_t size)
+{
+    struct gunzip *g = NULL;
+    uint8_t *buf = xalloc(size);
+    size_t got = 0;
+    ssize_t n = 0;
+    int ret = 0;
+
+    g = gunzip_open(name, s->data, s->len, threads);
+
+    if (g == NULL) {
+        warnx("%s: not decompressed", name);
+        free(buf);
+        return -1;
+    }
+
+    while ((n = gunzip_read(g, buf, size)) > 0) {
+        if (got + n > s->outlen || memcmp(buf, s->out + got, n)) {
+            warnx("%s: output differs near offset %zu", name, got);
+            ret = -1;
+            break;
+        }
+
+        got += n;
+    }
+
+    if (ret == 0 && (n == -1 || got != s->outlen)) {
+        warnx("%s: %zu of %zu bytes decompressed", name, got, s->outlen);
+        ret = -1;
+    }
+
+    gunzip_close(g);
+    free(buf);
+    return ret;
+}
+
+int
+main(void)
+{
+    struct stream s;
+    size_t start = 0;
+    int ret = EXIT_SUCCESS;
+    unsigned int threads = 0;
+
+    codes_init();
+    memset(&s, 0, sizeof(s));
+
+    /* a member split in to chunks */
+    gzip_header(&s);
+    huffman_block(&s, true, TEST_DYNAMIC_SIZE, 0, false);
+    stored_blocks(&s, TEST_STORED_SIZE, false);
+    huffman_block(&s, false, TEST_FIXED_SIZE, 0, false);
+    huffman_block(&s, false, 16, TEST_RUN_SIZE, false);
+    huffman_block(&s, true, TEST_DYNAMIC_SIZE, 0, true);
+    gzip_trailer(&s, 0);
+
+    /* and one decoded on its own */
+    start = s.outlen;
+    gzip_header(&s);
+    huffman_block(&s, false, 1000, 300, false);
+    stored_blocks(&s, 70000, false);
+    huffman_block(&s, true, 1000, 0, true);
+    gzip_trailer(&s, start);
+    align(&s);
+
+    if (s.len / GZIP_CHUNK_SIZE < 3) {
+        errx(EXIT_FAILURE, "test stream is only %zu bytes", s.len);
+    }
+
+    for (threads = 2; threads <= 8; threads *= 2) {
+        if (round_trip("multi", &s, threads, 65536) == -1 || round_trip("multi", &s, threads, 1000) == -1) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    /* a damaged trailer of the last member */
+    s.data[s.len - 8] ^= 1;
+
+    if (round_trip("damaged", &s, 4, 65536) == 0) {
+        warnx("damaged: not reported");
+        ret = EXIT_FAILURE;
+    }
+
+    stream_free(&s);
+
+    /* too small to split, left to rpmio */
+    gzip_header(&s);
+    huffman_block(&s, true, 4096, 0, true);
+    gzip_trailer(&s, 0);
+    align(&s);
+
+    if (gunzip_open("small", s.data, s.len, 4) != NULL) {
+        warnx("small: decompressed under the two-chunk minimum");
+        ret = EXIT_FAILURE;
+    }
+
+    stream_free(&s);
+    return ret;
+}
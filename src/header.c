@@ -10,69 +10,52 @@
 #include <arpa/inet.h>
 #include <rpm/header.h>
 #include <rpm/rpmtd.h>
-#include <json.h>
 
 #include "tarpm.h"
 
 /*
  * Iterate over the RPM header and write the data to a JSON file in
- * output_dir.  Returns 0 on success, -1 on error.
+ * output_dir.  Temporaries come from arena, which is reset before
+ * returning.  Returns 0 on success, -1 on error.
  */
 int
-extract_header(const int fd, const char *output_dir)
+extract_header(const struct rpmpkg *pkg, const char *output_dir, const struct tarpmopts *opts, struct arena *arena)
 {
-    uint32_t *buffer = NULL;
-    struct rpmsignature *sig = NULL;
-    struct rpmsigvalues *svals = NULL;
-    struct rpmidxentry *entry = NULL;
-    struct rpmidxentry *trailer = NULL;
-    struct json_object *out = NULL;
-    struct json_object *jvals = NULL;
+    const struct rpmsection *section = NULL;
+    const struct rpmidxentry *entry = NULL;
+    struct jsonw *w = NULL;
+    int ret = 0;
 
-    assert(fd > 0);
+    assert(pkg != NULL);
     assert(output_dir != NULL);
+    assert(opts != NULL);
+    assert(arena != NULL);
 
-    /* read in the signature */
-    sig = read_header_signature(fd);
-
-    if (sig == NULL) {
-        err(EXIT_FAILURE, "read_header_signature");
-    }
-
-    /* computed from header values */
-    svals = compute_sigvalues(sig, true);
-
-    /* read in the entries */
-    buffer = read_header_entries(fd, sig, svals->hlen);
-    svals->estart = (struct rpmidxentry *) &(buffer[2]);
-    svals->datastart = (uint8_t *) (svals->estart + sig->nentries);
+    /* read once when the package was opened */
+    section = &pkg->header;
 
     /* first entry */
-    entry = (struct rpmidxentry *) (buffer + 2);
+    entry = section->svals.estart;
 
-    /* handle trailer */
-    /* the trailer is not guaranteed to be aligned, copy required */
-    trailer = read_header_trailer(entry, svals->datastart);
+    /* write the header to a file as it is decoded */
+    w = json_open(arena, output_dir, OUTPUT_HEADER, !opts->compact_json);
 
-    /* generate a JSON structure for the signature */
-    out = generate_json(sig, svals);
+    if (w == NULL) {
+        arena_reset(arena);
+        return -1;
+    }
 
-    /* dump all of the tags in the signature */
-    jvals = generate_json_entries(sig, svals, entry, false);
+    json_begin_object(w, NULL);
+    generate_json(w, &section->sig, &section->svals);
 
-    /* write the signature to a file */
-    json_object_object_add(out, RPM_ENTRY_TAGS_DESC, json_object_get(jvals));
+    /* dump all of the tags in the header */
+    generate_json_entries(w, &section->sig, &section->svals, entry, false);
+    json_end_object(w);
 
-    if (write_json_file(out, output_dir, OUTPUT_HEADER) != 0) {
-        warn("write_json_file");
-    }
+    ret = json_close(w);
 
-    /* cleanup */
-    free_json(out);
-    json_object_put(jvals);
-    free(trailer);
-    free(buffer);
-    free(sig);
+    /* cleanup, everything above came from the arena */
+    arena_reset(arena);
 
-    return 0;
+    return ret;
 }
@@ -0,0 +1,116 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <err.h>
+#include <sys/stat.h>
+
+#include "tarpm.h"
+
+/*
+ * Parse a buffer size given on the command line.  The value is in
+ * bytes and may carry a K, M, or G suffix (powers of 1024).  Returns
+ * the size, or 0 if the string is not a valid size.
+ */
+size_t
+parse_size(const char *s)
+{
+    char *end = NULL;
+    unsigned long long n = 0;
+    unsigned int shift = 0;
+
+    if (s == NULL || !isdigit((unsigned char) *s)) {
+        return 0;
+    }
+
+    errno = 0;
+    n = strtoull(s, &end, 10);
+
+    if (errno || end == s) {
+        return 0;
+    }
+
+    switch (toupper((unsigned char) *end)) {
+        case '\0':
+            break;
+        case 'K':
+            shift = 10;
+            break;
+        case 'M':
+            shift = 20;
+            break;
+        case 'G':
+            shift = 30;
+            break;
+        default:
+            return 0;
+    }
+
+    if (*end != '\0' && (end[1] != '\0' && !(toupper((unsigned char) end[1]) == 'B' && end[2] == '\0'))) {
+        return 0;
+    }
+
+    if (n > (SIZE_MAX >> shift)) {
+        return 0;
+    }
+
+    return n << shift;
+}
+
+/*
+ * Round s up to a multiple of align.
+ */
+static size_t
+roundup_size(const size_t s, const size_t align)
+{
+    return ((s + align - 1) / align) * align;
+}
+
+/*
+ * Determine the buffer size to use for moving payload data of pkg.
+ * If requested is non-zero it is used as given, rounded up to the
+ * file system block size.  Otherwise the size scales with the amount
+ * of payload so small packages use small buffers and large packages
+ * make fewer, larger read and write calls.  Either way the result is
+ * a multiple of the preferred I/O size (st_blksize) of the package.
+ */
+size_t
+io_buffer_size(const struct rpmpkg *pkg, const size_t requested)
+{
+    struct stat sb;
+    size_t blksize = IO_BUFFER_MIN;
+    size_t payload = 0;
+    size_t size = 0;
+
+    assert(pkg != NULL);
+
+    if (fstat(pkg->fd, &sb) == 0) {
+        if (sb.st_blksize > 0) {
+            blksize = sb.st_blksize;
+        }
+
+        if (S_ISREG(sb.st_mode) && sb.st_size > pkg->payload_offset) {
+            payload = sb.st_size - pkg->payload_offset;
+        }
+    } else {
+        warn("fstat");
+    }
+
+    if (requested > 0) {
+        return roundup_size(requested, blksize);
+    }
+
+    /* aim for a few dozen buffers' worth of compressed payload */
+    size = IO_BUFFER_MIN;
+
+    while (size < IO_BUFFER_MAX && size * IO_BUFFER_SCALE < payload) {
+        size <<= 1;
+    }
+
+    return roundup_size(size, blksize);
+}
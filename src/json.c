@@ -3,89 +3,481 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+/*
+ * Streaming JSON writer.  Values are formatted straight in to a large
+ * output buffer as they are produced and the buffer is written out
+ * whenever it fills.  There is no intermediate tree and no per-value
+ * allocation.  Output is either pretty printed (two space indent) or
+ * compact.  A writer may also stream newline delimited records to a
+ * descriptor it does not own, such as standard output.
+ */
+
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <err.h>
-#include <json.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "tarpm.h"
 
+struct jsonw {
+    struct arena *arena;
+    int fd;
+    bool owned;                    /* fd is closed by json_close() */
+    char *buf;
+    size_t len;
+    size_t size;
+    bool pretty;
+    unsigned int depth;
+    bool first[JSON_MAX_DEPTH];    /* nothing written yet at this depth */
+    int error;                     /* first errno hit while writing */
+};
+
+/* Write out everything in the buffer. */
+static void
+json_flush(struct jsonw *w)
+{
+    size_t done = 0;
+    ssize_t r = 0;
+
+    while (done < w->len && !w->error) {
+        r = write(w->fd, w->buf + done, w->len - done);
+
+        if (r == -1 && errno == EINTR) {
+            continue;
+        } else if (r == -1) {
+            w->error = errno;
+            break;
+        }
+
+        done += r;
+    }
+
+    w->len = 0;
+    return;
+}
+
 /*
- * Takes the JSON data and writes it to the output_file in output_dir.
- * Returns 0 on success, -1 on error.
+ * Return space for at least n bytes at the end of the buffer.  The
+ * caller fills it and then calls json_commit() with what it used.
+ * Requests larger than the buffer grow it.
  */
-int
-write_json_file(struct json_object *data, const char *output_dir, const char *output_file)
+char *
+json_reserve(struct jsonw *w, const size_t n)
 {
-    char *s = NULL;
-    const char *js = NULL;
-    FILE *fp = NULL;
-    int r = 0;
-    int flags = JSON_C_TO_STRING_SPACED | JSON_C_TO_STRING_PRETTY;
+    assert(w != NULL);
 
-    assert(data != NULL);
-    assert(output_dir != NULL);
-    assert(output_file != NULL);
+    if (w->size - w->len < n) {
+        json_flush(w);
 
-    /* write the JSON data for a file */
-    s = joinpath(output_dir, output_file, NULL);
-    assert(s != NULL);
+        if (w->size < n) {
+            w->buf = arena_realloc(w->arena, w->buf, w->size, n);
+            w->size = n;
+        }
+    }
+
+    return w->buf + w->len;
+}
 
-    fp = fopen(s, "w");
+void
+json_commit(struct jsonw *w, const size_t n)
+{
+    assert(w != NULL);
+    assert(w->len + n <= w->size);
 
-    if (fp == NULL) {
-        warn("fopen");
-        return -1;
+    w->len += n;
+    return;
+}
+
+static void
+json_write(struct jsonw *w, const char *s, const size_t n)
+{
+    memcpy(json_reserve(w, n), s, n);
+    json_commit(w, n);
+    return;
+}
+
+static void
+json_indent(struct jsonw *w)
+{
+    char *p = NULL;
+    size_t n = 1 + (2 * w->depth);
+
+    p = json_reserve(w, n);
+    p[0] = '\n';
+    memset(p + 1, ' ', n - 1);
+    json_commit(w, n);
+    return;
+}
+
+/* Escape and quote a string. */
+static void
+json_quote(struct jsonw *w, const char *s, const size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i = 0;
+    size_t start = 0;
+    unsigned char c = 0;
+    char esc[6];
+
+    json_write(w, "\"", 1);
+
+    for (i = 0; i < n; i++) {
+        c = s[i];
+
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        /* copy the clean run, then the escape */
+        json_write(w, s + start, i - start);
+        start = i + 1;
+
+        esc[0] = '\\';
+
+        switch (c) {
+            case '"':
+            case '\\':
+                esc[1] = c;
+                json_write(w, esc, 2);
+                break;
+            case '\n':
+                json_write(w, "\\n", 2);
+                break;
+            case '\t':
+                json_write(w, "\\t", 2);
+                break;
+            case '\r':
+                json_write(w, "\\r", 2);
+                break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xf];
+                json_write(w, esc, 6);
+                break;
+        }
     }
 
-    free(s);
-    js = json_object_to_json_string_ext(data, flags);
+    json_write(w, s + start, n - start);
+    json_write(w, "\"", 1);
+    return;
+}
+
+/*
+ * Emit whatever precedes a value: the separator from the previous
+ * value, the indent, and the key if the value is an object member.
+ */
+static void
+json_prefix(struct jsonw *w, const char *key)
+{
+    if (!w->first[w->depth]) {
+        json_write(w, ",", 1);
+    }
 
-    if (js == NULL) {
-        errx(EXIT_FAILURE, "unable to turn JSON object in to string");
+    if (w->pretty && w->depth > 0) {
+        json_indent(w);
     }
 
-    fprintf(fp, "%s\n", js);
-    r = fflush(fp);
+    w->first[w->depth] = false;
 
-    if (r != 0) {
-        warn("fflush");
+    if (key != NULL) {
+        json_quote(w, key, strlen(key));
+        json_write(w, w->pretty ? ": " : ":", w->pretty ? 2 : 1);
     }
 
-    r = fclose(fp);
+    return;
+}
 
-    if (r != 0) {
-        warn("fclose");
+static void
+json_begin(struct jsonw *w, const char *key, const char *open)
+{
+    assert(w != NULL);
+    assert(w->depth + 1 < JSON_MAX_DEPTH);
+
+    json_prefix(w, key);
+    json_write(w, open, 1);
+    w->depth++;
+    w->first[w->depth] = true;
+    return;
+}
+
+static void
+json_end(struct jsonw *w, const char *close)
+{
+    bool empty = false;
+
+    assert(w != NULL);
+    assert(w->depth > 0);
+
+    empty = w->first[w->depth];
+    w->depth--;
+
+    if (w->pretty && !empty) {
+        json_indent(w);
     }
 
-    return 0;
+    json_write(w, close, 1);
+    return;
 }
 
 /*
- * Free memory used by JSON object
+ * Begin an object or array.  The key names the member when the
+ * enclosing value is an object and must be NULL otherwise.
  */
 void
-free_json(struct json_object *data)
+json_begin_object(struct jsonw *w, const char *key)
 {
-    int r = 0;
-    int len = 0;
-    struct json_object_iter iter;
+    json_begin(w, key, "{");
+    return;
+}
 
-    if (data == NULL) {
-        return;
-    }
+void
+json_end_object(struct jsonw *w)
+{
+    json_end(w, "}");
+    return;
+}
+
+void
+json_begin_array(struct jsonw *w, const char *key)
+{
+    json_begin(w, key, "[");
+    return;
+}
+
+void
+json_end_array(struct jsonw *w)
+{
+    json_end(w, "]");
+    return;
+}
+
+/* Emit a string value of n bytes, which need not be NUL terminated. */
+void
+json_stringn(struct jsonw *w, const char *key, const char *s, const size_t n)
+{
+    assert(w != NULL);
+    assert(s != NULL);
+
+    json_prefix(w, key);
+    json_quote(w, s, n);
+    return;
+}
+
+void
+json_string(struct jsonw *w, const char *key, const char *s)
+{
+    assert(s != NULL);
+
+    json_stringn(w, key, s, strlen(s));
+    return;
+}
 
-    /* clean up the JSON object memory usage */
-    json_object_object_foreachC(data, iter) {
-        if (json_object_get_type(iter.val) == json_type_array) {
-            len = json_object_array_length(iter.val);
+/*
+ * Emit a string value formatted directly in to the output buffer.
+ * The formatted text must not need escaping, which holds for numbers
+ * and fixed strings.
+ */
+void
+json_printf(struct jsonw *w, const char *key, const char *fmt, ...)
+{
+    va_list ap;
+    char *p = NULL;
+    size_t avail = JSON_FORMAT_MAX;
+    int n = 0;
 
-            for (r = 0; r < len; r++) {
-                json_object_array_put_idx(iter.val, r, NULL);
-            }
+    assert(w != NULL);
+    assert(fmt != NULL);
+
+    json_prefix(w, key);
+    json_write(w, "\"", 1);
+
+    while (1) {
+        p = json_reserve(w, avail);
+        va_start(ap, fmt);
+        n = vsnprintf(p, avail, fmt, ap);
+        va_end(ap);
+        assert(n >= 0);
+
+        if ((size_t) n < avail) {
+            break;
         }
+
+        avail = n + 1;
+    }
+
+    json_commit(w, n);
+    json_write(w, "\"", 1);
+    return;
+}
+
+/*
+ * Emit an unsigned integer as a decimal string value.  This is the
+ * common case for large header arrays, so it avoids the printf
+ * machinery.
+ */
+void
+json_uint(struct jsonw *w, const char *key, uint64_t v)
+{
+    char digits[20];
+    char *p = NULL;
+    size_t n = 0;
+
+    assert(w != NULL);
+
+    do {
+        digits[sizeof(digits) - 1 - n++] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+
+    json_prefix(w, key);
+    p = json_reserve(w, n + 2);
+    p[0] = '"';
+    memcpy(p + 1, digits + sizeof(digits) - n, n);
+    p[n + 1] = '"';
+    json_commit(w, n + 2);
+    return;
+}
+
+/*
+ * Emit binary data as a base64 string value.  The data is encoded
+ * straight in to the output buffer a chunk at a time, so blobs of any
+ * size need no temporary copy.
+ */
+void
+json_base64(struct jsonw *w, const char *key, const void *data, const size_t n)
+{
+    size_t done = 0;
+    size_t chunk = 0;
+
+    assert(w != NULL);
+    assert(data != NULL || n == 0);
+
+    json_prefix(w, key);
+    json_write(w, "\"", 1);
+
+    while (done < n) {
+        chunk = (n - done > JSON_BASE64_CHUNK) ? JSON_BASE64_CHUNK : n - done;
+        json_commit(w, base64_encode(json_reserve(w, base64_length(chunk)), (const uint8_t *) data + done, chunk));
+        done += chunk;
     }
 
-    json_object_put(data);
+    json_write(w, "\"", 1);
+    return;
+}
+
+/*
+ * End a top level value as one record of newline delimited JSON.  The
+ * next value starts a new record rather than continuing this one.
+ */
+void
+json_end_record(struct jsonw *w)
+{
+    assert(w != NULL);
+    assert(w->depth == 0);
+
+    json_write(w, "\n", 1);
+    w->first[0] = true;
     return;
 }
+
+static struct jsonw *
+json_new(struct arena *arena, const int fd, const bool owned, const bool pretty)
+{
+    struct jsonw *w = NULL;
+
+    w = arena_alloc(arena, sizeof(*w));
+    w->arena = arena;
+    w->fd = fd;
+    w->owned = owned;
+    w->pretty = pretty;
+    w->first[0] = true;
+    w->size = JSON_BUFFER_SIZE;
+    w->buf = arena_alloc(arena, w->size);
+    return w;
+}
+
+/*
+ * Begin writing JSON to output_file in output_dir.  The writer and its
+ * buffer are allocated from arena and go away with it.  Returns a
+ * writer on success or NULL if the file cannot be created.
+ */
+struct jsonw *
+json_open(struct arena *arena, const char *output_dir, const char *output_file, const bool pretty)
+{
+    int fd = -1;
+    char *s = NULL;
+
+    assert(output_dir != NULL);
+    assert(output_file != NULL);
+
+    s = joinpath(output_dir, output_file, NULL);
+    assert(s != NULL);
+
+    fd = open(s, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        warn("open %s", s);
+        free(s);
+        return NULL;
+    }
+
+    free(s);
+    return json_new(arena, fd, true, pretty);
+}
+
+/*
+ * Begin writing compact newline delimited JSON records to fd, which
+ * stays open after json_close().  End each record with
+ * json_end_record().
+ */
+struct jsonw *
+json_stream(struct arena *arena, const int fd)
+{
+    assert(fd >= 0);
+
+    return json_new(arena, fd, false, false);
+}
+
+/*
+ * Finish the JSON output and close the file (a stream's descriptor is
+ * left open).  The writer's memory belongs to the arena it was opened
+ * with.  Returns 0 on success, -1 if anything could not be written.
+ */
+int
+json_close(struct jsonw *w)
+{
+    int ret = 0;
+
+    if (w == NULL) {
+        return -1;
+    }
+
+    assert(w->depth == 0);
+
+    /* records already end with a newline */
+    if (!w->first[0]) {
+        json_write(w, "\n", 1);
+    }
+
+    json_flush(w);
+
+    if (w->error) {
+        errno = w->error;
+        warn("write");
+        ret = -1;
+    }
+
+    if (w->owned && close(w->fd) == -1) {
+        warn("close");
+        ret = -1;
+    }
+
+    return ret;
+}
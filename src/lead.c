@@ -9,78 +9,61 @@
 #include <err.h>
 #include <arpa/inet.h>
 #include <rpm/header.h>
-#include <json.h>
 
 #include "tarpm.h"
 
 /*
- * Extract the data of the RPM lead and convert it to JSON data.
- * Returns 0 on success, -1 on error.
+ * Convert the RPM lead of the package to JSON data.  Temporaries come
+ * from arena, which is reset before returning.  Returns 0 on success,
+ * -1 on error.
  */
 int
-extract_lead(const int fd, const char *output_dir)
+extract_lead(const struct rpmpkg *pkg, const char *output_dir, const struct tarpmopts *opts, struct arena *arena)
 {
-    struct rpmlead lead;
-    struct json_object *out = NULL;
-    char *s = NULL;
+    const struct rpmlead *lead = NULL;
+    struct jsonw *w = NULL;
+    int ret = 0;
 
-    assert(fd > 0);
+    assert(pkg != NULL);
     assert(output_dir != NULL);
+    assert(opts != NULL);
+    assert(arena != NULL);
 
-    /* zero out the lead structure */
-    memset(&lead, 0, sizeof(lead));
+    lead = &pkg->lead;
 
-    /* read in the lead */
-    if (read(fd, &lead, RPMLEAD_SIZE) != RPMLEAD_SIZE) {
-        err(EXIT_FAILURE, "read");
-    }
-
-    /* convert some lead fields from network byte order to host byte order */
-    lead.type = ntohs(lead.type);
-    lead.osnum = ntohs(lead.osnum);
-    lead.archnum = ntohs(lead.archnum);
-    lead.signature_type = ntohs(lead.signature_type);
-
-    /* generate a JSON structure for the lead */
-    out = json_object_new_object();
+    /* write the lead to a JSON file */
+    w = json_open(arena, output_dir, OUTPUT_LEAD, !opts->compact_json);
 
-    xasprintf(&s, "0x%hhX%hhX%hhX%hhX", lead.magic[0], lead.magic[1], lead.magic[2], lead.magic[3]);
-    json_object_object_add(out, RPM_LEAD_MAGIC, json_object_new_string(s));
-    free(s);
+    if (w == NULL) {
+        arena_reset(arena);
+        return -1;
+    }
 
-    xasprintf(&s, "%d.%d", lead.major, lead.minor);
-    json_object_object_add(out, RPM_LEAD_VERSION, json_object_new_string(s));
-    free(s);
+    json_begin_object(w, NULL);
+    json_printf(w, RPM_LEAD_MAGIC, "0x%hhX%hhX%hhX%hhX", lead->magic[0], lead->magic[1], lead->magic[2], lead->magic[3]);
+    json_printf(w, RPM_LEAD_VERSION, "%d.%d", lead->major, lead->minor);
 
-    if (lead.type) {
-        json_object_object_add(out, RPM_LEAD_TYPE, json_object_new_string(RPM_LEAD_SOURCE));
+    if (lead->type) {
+        json_string(w, RPM_LEAD_TYPE, RPM_LEAD_SOURCE);
     } else {
-        json_object_object_add(out, RPM_LEAD_TYPE, json_object_new_string(RPM_LEAD_BINARY));
+        json_string(w, RPM_LEAD_TYPE, RPM_LEAD_BINARY);
     }
 
-    json_object_object_add(out, RPM_LEAD_NAME, json_object_new_string(lead.name));
+    /* the name is not guaranteed to be terminated */
+    json_stringn(w, RPM_LEAD_NAME, lead->name, strnlen(lead->name, sizeof(lead->name)));
+    json_printf(w, RPM_LEAD_ARCH, "%hu", lead->archnum);
+    json_printf(w, RPM_LEAD_OS, "%hu", lead->osnum);
 
-    xasprintf(&s, "%hu", lead.archnum);
-    json_object_object_add(out, RPM_LEAD_ARCH, json_object_new_string(s));
-    free(s);
-
-    xasprintf(&s, "%hu", lead.osnum);
-    json_object_object_add(out, RPM_LEAD_OS, json_object_new_string(s));
-    free(s);
-
-    if (lead.signature_type == 5) {
-        json_object_object_add(out, RPM_LEAD_SIGTYPE, json_object_new_string(RPM_LEAD_HEADERSIG));
+    if (lead->signature_type == 5) {
+        json_string(w, RPM_LEAD_SIGTYPE, RPM_LEAD_HEADERSIG);
     } else {
-        json_object_object_add(out, RPM_LEAD_SIGTYPE, json_object_new_string(RPM_LEAD_UNKNOWN));
+        json_string(w, RPM_LEAD_SIGTYPE, RPM_LEAD_UNKNOWN);
     }
 
-    /* write the lead to a JSON file */
-    if (write_json_file(out, output_dir, OUTPUT_LEAD) != 0) {
-        warn("write_json_file");
-    }
+    json_end_object(w);
 
-    /* cleanup */
-    free_json(out);
+    ret = json_close(w);
+    arena_reset(arena);
 
-    return 0;
+    return ret;
 }
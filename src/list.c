@@ -0,0 +1,225 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Payload listing for -t.  Everything comes from the file arrays in
+ * the header (BASENAMES, DIRNAMES, DIRINDEXES, FILEMODES, FILESIZES,
+ * and so on), so the payload is never opened and listing a package
+ * costs no more than reading its header.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <rpm/rpmfiles.h>
+
+#include "tarpm.h"
+
+/* Name the file type for the NDJSON "type" member. */
+static const char *
+file_type(const rpm_mode_t mode)
+{
+    switch (mode & S_IFMT) {
+        case S_IFREG:
+            return "file";
+        case S_IFDIR:
+            return "directory";
+        case S_IFLNK:
+            return "symlink";
+        case S_IFCHR:
+            return "char";
+        case S_IFBLK:
+            return "block";
+        case S_IFIFO:
+            return "fifo";
+        case S_IFSOCK:
+            return "socket";
+        default:
+            return "unknown";
+    }
+}
+
+/*
+ * Print one file the way tar -t does: just the path, or with verbose
+ * a long listing with permissions, owner, size, mtime, and the link
+ * target.
+ */
+static void
+list_text(rpmfiles files, const int fx, const char *path, const bool verbose)
+{
+    char *perms = NULL;
+    const char *user = NULL;
+    const char *group = NULL;
+    const char *link = NULL;
+    time_t mtime = 0;
+    struct tm tm;
+    char when[LIST_TIME_SIZE];
+    rpm_mode_t mode = rpmfilesFMode(files, fx);
+
+    if (!verbose) {
+        printf("%s\n", path);
+        return;
+    }
+
+    perms = rpmPermsString(mode);
+    assert(perms != NULL);
+    user = rpmfilesFUser(files, fx);
+    group = rpmfilesFGroup(files, fx);
+    mtime = rpmfilesFMtime(files, fx);
+
+    if (localtime_r(&mtime, &tm) == NULL || strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm) == 0) {
+        snprintf(when, sizeof(when), "%lld", (long long) mtime);
+    }
+
+    printf("%s %s/%s %8llu %s %s", perms, user ? user : "?", group ? group : "?",
+           (unsigned long long) rpmfilesFSize(files, fx), when, path);
+
+    if (S_ISLNK(mode) && (link = rpmfilesFLink(files, fx)) != NULL && *link != '\0') {
+        printf(" -> %s", link);
+    }
+
+    printf("\n");
+    free(perms);
+    return;
+}
+
+/* Write one file as an NDJSON record. */
+static void
+list_json(struct jsonw *w, rpmfiles files, const int fx, const char *path, const char *package)
+{
+    const char *name = NULL;
+    rpm_mode_t mode = rpmfilesFMode(files, fx);
+
+    json_begin_object(w, NULL);
+    json_string(w, "package", package);
+    json_string(w, "path", path);
+    json_string(w, "type", file_type(mode));
+    json_printf(w, "mode", "%04o", mode & ~S_IFMT);
+    json_uint(w, "size", rpmfilesFSize(files, fx));
+
+    if ((name = rpmfilesFUser(files, fx)) != NULL) {
+        json_string(w, "user", name);
+    }
+
+    if ((name = rpmfilesFGroup(files, fx)) != NULL) {
+        json_string(w, "group", name);
+    }
+
+    json_uint(w, "mtime", rpmfilesFMtime(files, fx));
+
+    if (S_ISLNK(mode) && (name = rpmfilesFLink(files, fx)) != NULL) {
+        json_string(w, "link", name);
+    }
+
+    json_end_object(w);
+    json_end_record(w);
+    return;
+}
+
+/*
+ * List the payload of the package at path from its header.  Records
+ * go to w when it is not NULL, otherwise text goes to stdout.  With
+ * opts->filter only the selected files are listed.  Returns 0 on
+ * success, -1 if the package cannot be read or a named member is not
+ * in it.
+ */
+int
+list_package(const char *path, const struct tarpmopts *opts, struct jsonw *w)
+{
+    int i = 0;
+    int nfiles = 0;
+    int ret = 0;
+    size_t count = 0;
+    bool *selected = NULL;
+    char *fn = NULL;
+    struct rpmpkg *pkg = NULL;
+    rpmfiles files = NULL;
+
+    assert(path != NULL);
+    assert(opts != NULL);
+
+    pkg = open_rpm_package(path);
+
+    if (pkg == NULL) {
+        warnx(_("*** %s is not a valid RPM"), path);
+        return -1;
+    }
+
+    files = rpmfilesNew(NULL, pkg->h, 0, RPMFI_KEEPHEADER);
+
+    if (files == NULL) {
+        warnx(_("*** %s: unable to read the file list"), path);
+        close_rpm_package(pkg);
+        return -1;
+    }
+
+    if (opts->filter != NULL) {
+        ret = filter_files(opts->filter, files, path, &selected, &count);
+    }
+
+    nfiles = rpmfilesFC(files);
+
+    for (i = 0; i < nfiles; i++) {
+        if (selected != NULL && !selected[i]) {
+            continue;
+        }
+
+        fn = rpmfilesFN(files, i);
+        assert(fn != NULL);
+
+        if (w != NULL) {
+            list_json(w, files, i, fn, path);
+        } else {
+            list_text(files, i, fn, opts->verbose);
+        }
+
+        free(fn);
+    }
+
+    free(selected);
+    rpmfilesFree(files);
+    close_rpm_package(pkg);
+
+    return ret;
+}
+
+/*
+ * List every package in paths, as NDJSON records if opts->ndjson.
+ * Returns the number of packages that could not be listed.
+ */
+size_t
+list_packages(char **paths, const size_t npaths, const struct tarpmopts *opts)
+{
+    size_t i = 0;
+    size_t failed = 0;
+    struct arena *arena = NULL;
+    struct jsonw *w = NULL;
+
+    assert(paths != NULL || npaths == 0);
+    assert(opts != NULL);
+
+    if (opts->ndjson) {
+        arena = arena_new(ARENA_BLOCK_SIZE);
+        w = json_stream(arena, STDOUT_FILENO);
+    }
+
+    for (i = 0; i < npaths; i++) {
+        if (list_package(paths[i], opts, w) == -1) {
+            failed++;
+        }
+    }
+
+    if (w != NULL && json_close(w) == -1) {
+        failed++;
+    }
+
+    arena_free(arena);
+    return failed;
+}
@@ -11,21 +11,148 @@
 #include <getopt.h>
 #include <locale.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
 #include <err.h>
 #include <assert.h>
 #include <rpm/header.h>
 
 #include "tarpm.h"
 
+/* long options without a short option equivalent */
+enum {
+    OPT_THREADS = 256,
+    OPT_BUFFER_SIZE,
+    OPT_METADATA_ONLY,
+    OPT_COMPACT_JSON,
+    OPT_JOBS,
+    OPT_VERIFY,
+    OPT_CHECK,
+    OPT_NDJSON,
+    OPT_INCLUDE,
+    OPT_EXCLUDE,
+    OPT_TO_ARCHIVE,
+    OPT_ARCHIVE_FORMAT,
+    OPT_COMPRESSION_LEVEL,
+};
+
+/*
+ * Parse a non-negative count from a command line argument or exit
+ * with an error naming the option.
+ */
+static unsigned int
+parse_count(const char *arg, const char *option)
+{
+    char *end = NULL;
+    unsigned long n = 0;
+
+    errno = 0;
+    n = strtoul(arg, &end, 10);
+
+    if (errno || end == arg || *end != '\0' || *arg == '-' || n > UINT_MAX) {
+        errx(EXIT_FAILURE, _("*** invalid value for %s: %s"), option, arg);
+    }
+
+    return n;
+}
+
+/* Add a package to the list to extract. */
+static void
+add_package(char ***paths, size_t *n, const char *path)
+{
+    *paths = xrealloc(*paths, (*n + 1) * sizeof(**paths));
+    (*paths)[*n] = strdup(path);
+    assert((*paths)[*n] != NULL);
+    (*n)++;
+    return;
+}
+
+/*
+ * True if s is a run of tar(1) style short options such as "xvf".
+ * It must name a mode, so a member or package with a name made of
+ * option letters is not mistaken for one.
+ */
+static bool
+is_short_syntax(const char *s)
+{
+    return strspn(s, "cxtvOf") == strlen(s) && strpbrk(s, "cxt") != NULL;
+}
+
+/*
+ * Number of payload writer threads to use when not specified.  One
+ * CPU is left for the thread reading the payload.  When several
+ * packages are extracted at once the jobs already use the CPUs, so
+ * each payload is written inline.
+ */
+static unsigned int
+default_threads(const unsigned int jobs)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpus <= 1 || jobs > 1) {
+        return 0;
+    }
+
+    return (ncpus - 1 > PIPELINE_MAX_THREADS) ? PIPELINE_MAX_THREADS : ncpus - 1;
+}
+
+/*
+ * Number of threads that decompress a payload.  A payload laid out
+ * for it can use every CPU, unless several packages are extracted at
+ * once.
+ */
+static unsigned int
+default_decoders(const unsigned int jobs)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (ncpus <= 1 || jobs > 1) ? 1 : ncpus;
+}
+
+/*
+ * Number of threads that compress an archive written by --to-archive.
+ * The payload writers are not used then, so --threads sets this, and
+ * otherwise every CPU is used.
+ */
+static unsigned int
+default_compressors(const bool havethreads, const unsigned int threads)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (havethreads) {
+        return threads ? threads : 1;
+    }
+
+    return (ncpus <= 1) ? 1 : ncpus;
+}
+
 static void
 usage(void)
 {
     printf(_("Binary RPM extraction and creation utility\n"));
-    printf(_("Usage: %s [OPTIONS] [binary .rpm file]\n"), COMMAND_NAME);
+    printf(_("Usage: %s [OPTIONS] [binary .rpm file ...]\n"), COMMAND_NAME);
+    printf(_("       %s [OPTIONS] -f binary .rpm file [member ...]\n"), COMMAND_NAME);
     printf(_("Options:\n"));
     printf(_("    -x, --extract                     Extract binary RPM file\n"));
+    printf(_("    -t, --list                        List the payload of binary RPM file\n"));
     printf(_("    -v, --verbose                     Verbose progress output\n"));
-    printf(_("    -f FILENAME, --filename=FILENAME  Use FILENAME as input or output\n"));
+    printf(_("    -O, --to-stdout                   Extract the payload to stdout as a tar stream\n"));
+    printf(_("    -f FILENAME, --filename=FILENAME  Use FILENAME as input or output (- for stdin)\n"));
+    printf(_("    -T LISTFILE, --files-from=LISTFILE\n"));
+    printf(_("                                      Extract the packages listed in LISTFILE (- for stdin)\n"));
+    printf(_("    --jobs=N                          Extract up to N packages at the same time\n"));
+    printf(_("    --threads=N                       Write the payload with N threads (0 writes inline)\n"));
+    printf(_("    --buffer-size=SIZE                Payload I/O buffer size (K, M, G suffixes allowed)\n"));
+    printf(_("    --metadata-only                   Extract the JSON metadata but not the payload\n"));
+    printf(_("    --compact-json                    Write the JSON metadata without whitespace\n"));
+    printf(_("    --verify                          Check payload digests while extracting\n"));
+    printf(_("    --check                           Verify packages without extracting anything\n"));
+    printf(_("    --ndjson                          List as newline delimited JSON records\n"));
+    printf(_("    --include=PATTERN                 Only extract or list payload paths matching PATTERN\n"));
+    printf(_("    --exclude=PATTERN                 Skip payload paths matching PATTERN\n"));
+    printf(_("    --to-archive=FILE                 Convert the payload to a tar or cpio archive (- for stdout)\n"));
+    printf(_("    --archive-format=FORMAT           Archive format: tar, cpio, optionally with .gz, .xz, or .zst\n"));
+    printf(_("    --compression-level=N             Compression level for the archive\n"));
     printf(_("    -V, --version                     Display version information\n"));
     printf(_("    -?, --help                        Display this screen\n"));
     printf(_("See the %s(1) man page for more information.\n"), COMMAND_NAME);
@@ -40,29 +167,54 @@ main(int argc, char **argv)
     int idx = 0;
     bool extract = false;
     bool create = false;
-    bool verbose = false;
+    bool list = false;
     bool havefilename = false;
-    char *tmp = NULL;
-    char *payload_file = NULL;
+    bool havethreads = false;
+    bool tostdout = false;
+    bool liststdin = false;
+    size_t nstdin = 0;
     char *filename = NULL;
     char *cwd = NULL;
-    char *output_dir = NULL;
-    int flags = R_OK;
-    int mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-    int rpmfd = 0;
-    Header h;
+    char **paths = NULL;
+    size_t npaths = 0;
+    size_t i = 0;
+    size_t failed = 0;
+    unsigned int level = 0;
+    struct tarpmopts opts;
+    struct filter *filter = NULL;
     char *opt = NULL;
-    char *short_opts = "xcvf:V\?";
+    char *short_opts = "xctvOf:T:V\?";
     struct option long_opts[] = {
         { "extract", no_argument, 0, 'x' },
         { "create", no_argument, 0, 'c' },
+        { "list", no_argument, 0, 't' },
         { "verbose", no_argument, 0, 'v' },
+        { "to-stdout", no_argument, 0, 'O' },
         { "filename", required_argument, 0, 'f' },
+        { "files-from", required_argument, 0, 'T' },
+        { "jobs", required_argument, 0, OPT_JOBS },
+        { "threads", required_argument, 0, OPT_THREADS },
+        { "buffer-size", required_argument, 0, OPT_BUFFER_SIZE },
+        { "metadata-only", no_argument, 0, OPT_METADATA_ONLY },
+        { "compact-json", no_argument, 0, OPT_COMPACT_JSON },
+        { "verify", no_argument, 0, OPT_VERIFY },
+        { "check", no_argument, 0, OPT_CHECK },
+        { "ndjson", no_argument, 0, OPT_NDJSON },
+        { "include", required_argument, 0, OPT_INCLUDE },
+        { "exclude", required_argument, 0, OPT_EXCLUDE },
+        { "to-archive", required_argument, 0, OPT_TO_ARCHIVE },
+        { "archive-format", required_argument, 0, OPT_ARCHIVE_FORMAT },
+        { "compression-level", required_argument, 0, OPT_COMPRESSION_LEVEL },
         { "version", no_argument, 0, 'V' },
         { "help", no_argument, 0, '?' },
         { 0, 0, 0, 0 }
     };
 
+    /* Defaults */
+    memset(&opts, 0, sizeof(opts));
+    opts.jobs = 1;
+    opts.compression_level = -1;
+
     /* Allow users to do "tarpm ... 2>&1 | tee" */
     setlinebuf(stdout);
 
@@ -86,7 +238,6 @@ main(int argc, char **argv)
                 }
 
                 extract = true;
-                flags = R_OK;
                 break;
             case 'c':
                 if (extract) {
@@ -94,17 +245,94 @@ main(int argc, char **argv)
                 }
 
                 create = true;
-                flags = W_OK;
+                break;
+            case 't':
+                list = true;
                 break;
             case 'v':
-                verbose = true;
+                opts.verbose = true;
+                break;
+            case 'O':
+                tostdout = true;
                 break;
             case 'f':
                 if (filename) {
                     errx(EXIT_FAILURE, _("*** -f already specified; only allowed once"));
                 }
 
-                filename = realpath(optarg, NULL);
+                filename = optarg;
+                add_package(&paths, &npaths, optarg);
+                break;
+            case 'T':
+                liststdin = liststdin || !strcmp(optarg, "-");
+
+                if (read_package_list(optarg, &paths, &npaths) == -1) {
+                    errx(EXIT_FAILURE, _("*** unable to read package list %s"), optarg);
+                }
+
+                break;
+            case OPT_THREADS:
+                opts.threads = parse_count(optarg, "--threads");
+                havethreads = true;
+                break;
+            case OPT_JOBS:
+                opts.jobs = parse_count(optarg, "--jobs");
+
+                if (opts.jobs == 0) {
+                    errx(EXIT_FAILURE, _("*** invalid value for --jobs: %s"), optarg);
+                }
+
+                break;
+            case OPT_BUFFER_SIZE:
+                opts.buffer_size = parse_size(optarg);
+
+                if (opts.buffer_size < IO_BUFFER_MIN_REQUEST) {
+                    errx(EXIT_FAILURE, _("*** invalid value for --buffer-size: %s"), optarg);
+                }
+
+                break;
+            case OPT_METADATA_ONLY:
+                opts.metadata_only = true;
+                break;
+            case OPT_COMPACT_JSON:
+                opts.compact_json = true;
+                break;
+            case OPT_VERIFY:
+                opts.verify = true;
+                break;
+            case OPT_CHECK:
+                opts.check = true;
+                opts.verify = true;
+                break;
+            case OPT_NDJSON:
+                opts.ndjson = true;
+                break;
+            case OPT_INCLUDE:
+                filter = filter ? filter : filter_new();
+                filter_include(filter, optarg);
+                break;
+            case OPT_EXCLUDE:
+                filter = filter ? filter : filter_new();
+                filter_exclude(filter, optarg);
+                break;
+            case OPT_TO_ARCHIVE:
+                opts.archive = optarg;
+                break;
+            case OPT_ARCHIVE_FORMAT:
+                if (!archive_format_valid(optarg)) {
+                    errx(EXIT_FAILURE, _("*** unknown archive format: %s"), optarg);
+                }
+
+                opts.archive_format = optarg;
+                break;
+            case OPT_COMPRESSION_LEVEL:
+                level = parse_count(optarg, "--compression-level");
+
+                if (level > INT_MAX) {
+                    errx(EXIT_FAILURE, _("*** invalid value for --compression-level: %s"), optarg);
+                }
+
+                opts.compression_level = level;
                 break;
             case 'V':
                 printf(_("%s version %s\n"), COMMAND_NAME, PACKAGE_VERSION);
@@ -121,18 +349,24 @@ main(int argc, char **argv)
      * Handle the common short form syntax for tar(1) options, such as:
      *     tar xvf FILENAME.tar
      *     tar cvf FILENAME.tar
+     * Only the first argument is looked at, and only when no mode was
+     * given as an ordinary option.
      */
-    if ((optind + 1) != argc) {
+    if (optind < argc && !extract && !create && !list && is_short_syntax(argv[optind])) {
         /* process common short syntax options that may exist */
-        opt = argv[optind];
+        opt = argv[optind++];
 
-        while (opt && *opt != '\0') {
+        while (*opt != '\0') {
             if (*opt == 'c') {
                 create = true;
             } else if (*opt == 'x') {
                 extract = true;
+            } else if (*opt == 't') {
+                list = true;
             } else if (*opt == 'v') {
-                verbose = true;
+                opts.verbose = true;
+            } else if (*opt == 'O') {
+                tostdout = true;
             } else if (*opt == 'f') {
                 /* the filename must come after 'f' */
                 if (filename) {
@@ -140,141 +374,160 @@ main(int argc, char **argv)
                 }
 
                 havefilename = true;
-                break;
             }
 
             opt++;
         }
 
         /* pick up the 'f' filename if we don't have one */
-        if (havefilename && !access(argv[optind + 1], flags)) {
-            filename = realpath(argv[optind + 1], NULL);
+        if (havefilename && optind < argc) {
+            filename = argv[optind++];
+            add_package(&paths, &npaths, filename);
         }
     }
 
-    /* Make sure we have minimal options specified */
-    if (!extract && !create) {
-        errx(EXIT_FAILURE, _("*** must specify at least -x or -c"));
+    /*
+     * With -f, any other arguments name payload members to extract or
+     * list, as with tar(1).  Otherwise they are more packages.
+     */
+    while (optind < argc) {
+        if (filename) {
+            filter = filter ? filter : filter_new();
+            filter_member(filter, argv[optind++]);
+        } else {
+            add_package(&paths, &npaths, argv[optind++]);
+        }
     }
 
-    if (filename == NULL) {
-        errx(EXIT_FAILURE, _("*** missing filename (-f) argument"));
+    if (filter) {
+        filter_compile(filter);
+        opts.filter = filter;
     }
 
-    /* figure out where we actually are */
-    cwd = getcwd(NULL, 0);
+    /* -O is --to-archive=- for extraction, a tar stream by default */
+    if (tostdout) {
+        if (opts.archive && strcmp(opts.archive, "-")) {
+            errx(EXIT_FAILURE, _("*** -O and --to-archive specified together; unsupported"));
+        }
 
-    if (cwd == NULL) {
-        err(EXIT_FAILURE, "getcwd");
+        opts.archive = "-";
     }
 
-    /* Initialize librpm */
-    if (init_librpm() != RPMRC_OK) {
-        errx(EXIT_FAILURE, _("*** unable to read RPM configuration"));
+    /* Make sure we have minimal options specified */
+    if (!extract && !create && !list && !opts.check && !opts.archive) {
+        errx(EXIT_FAILURE, _("*** must specify at least -x, -t, -c, -O, or --to-archive"));
     }
 
-    /* Main operations begin here */
-    if (extract) {
-        /* validate the specified file is an RPM */
-        h = get_rpm_header(filename);
+    if (list && (extract || create || opts.check || opts.archive)) {
+        errx(EXIT_FAILURE, _("*** -t cannot be used with -x, -c, --check, -O, or --to-archive"));
+    }
 
-        if (h == NULL) {
-            errx(EXIT_FAILURE, _("*** %s is not a valid RPM"), filename);
-        }
+    if (opts.archive && (create || opts.check || opts.metadata_only)) {
+        errx(EXIT_FAILURE, _("*** -O and --to-archive cannot be used with -c, --check, or --metadata-only"));
+    }
 
-        /* open the RPM file (this handle will be passed around) */
-        rpmfd = open(filename, O_RDONLY);
+    if (opts.archive && !strcmp(opts.archive, "-") && isatty(STDOUT_FILENO)) {
+        errx(EXIT_FAILURE, _("*** refusing to write an archive to a terminal"));
+    }
 
-        if (rpmfd == -1) {
-            err(EXIT_FAILURE, "open");
-        }
+    if ((opts.archive_format || opts.compression_level >= 0) && !opts.archive) {
+        errx(EXIT_FAILURE, _("*** --archive-format and --compression-level need -O or --to-archive"));
+    }
 
-        /* make a unique output directory name if we need to */
-        if (output_dir == NULL) {
-            /*
-             * XXX: this should build a path and use abspath() from rpminspect, but that can come later
-             */
-            tmp = get_nevra(h);
-            assert(tmp != NULL);
+    if (create && opts.check) {
+        errx(EXIT_FAILURE, _("*** -c and --check specified together; unsupported"));
+    }
 
-            xasprintf(&output_dir, "%s/%s", cwd, tmp);
-            assert(output_dir != NULL);
+    if (opts.metadata_only && opts.check) {
+        errx(EXIT_FAILURE, _("*** --metadata-only and --check specified together; unsupported"));
+    }
 
-            free(tmp);
-        }
+    if (npaths == 0) {
+        errx(EXIT_FAILURE, _("*** missing filename (-f) argument"));
+    }
 
-        /* create the output directory */
-        if (mkdirp(output_dir, mode) == -1) {
-            return EXIT_FAILURE;
-        }
+    /* "-" reads a package from stdin, which can only happen once */
+    for (i = 0; i < npaths; i++) {
+        nstdin += !strcmp(paths[i], "-");
+    }
 
-        /* extract the RPM lead -- the first header (unused) */
-        if (extract_lead(rpmfd, output_dir) == -1) {
-            err(EXIT_FAILURE, "extract_lead");
-        }
+    if (nstdin > 1 || (nstdin && liststdin)) {
+        errx(EXIT_FAILURE, _("*** standard input can only be read once"));
+    }
 
-        /* extract the RPM signature -- the second header (sort of used) */
-        if (extract_signature(rpmfd, output_dir) == -1) {
-            err(EXIT_FAILURE, "extract_signature");
-        }
+    if (nstdin && isatty(STDIN_FILENO)) {
+        errx(EXIT_FAILURE, _("*** refusing to read a package from a terminal"));
+    }
 
-        /* extract the RPM header -- the third header (used) */
-        if (extract_header(rpmfd, output_dir) == -1) {
-            err(EXIT_FAILURE, "extract_header");
-        }
+    if (!havethreads) {
+        opts.threads = default_threads(opts.jobs);
+    }
 
-        /* close the RPM after reading headers */
-        if (close(rpmfd) == -1) {
-            warn("close");
-        }
+    opts.decoders = default_decoders(opts.jobs);
+    opts.compressors = default_compressors(havethreads, opts.threads);
 
-        /* extract the RPM payload as an archive we can read in libarchive */
-        if (chdir(output_dir) == -1) {
-            err(EXIT_FAILURE, "chdir");
-        }
+    /* figure out where we actually are */
+    cwd = getcwd(NULL, 0);
 
-        payload_file = extract_rpm_payload(filename);
+    if (cwd == NULL) {
+        err(EXIT_FAILURE, "getcwd");
+    }
 
-        if (payload_file == NULL) {
-            errx(EXIT_FAILURE, "extract_rpm_payload");
-        }
+    /* Initialize librpm once for every package */
+    if (init_librpm() != RPMRC_OK) {
+        errx(EXIT_FAILURE, _("*** unable to read RPM configuration"));
+    }
 
-        if (chdir(cwd) == -1) {
-            err(EXIT_FAILURE, "chdir");
-        }
+    /* Main operations begin here */
+    if (list) {
+        /* listings are written in bulk, not a line at a time */
+        setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
 
-        /* unpack the RPM payload */
-        xasprintf(&tmp, "%s/%s", output_dir, PAYLOAD_SUBDIR);
-        assert(tmp != NULL);
+        /* answered from the headers, payloads are never read */
+        failed = list_packages(paths, npaths, &opts);
+        fflush(stdout);
 
-        if (mkdirp(tmp, mode) == -1) {
-            return EXIT_FAILURE;
+        if (failed && npaths > 1) {
+            warnx(_("*** %zu of %zu packages could not be listed"), failed, npaths);
         }
+    } else if (opts.archive) {
+        /* every payload goes in to the one archive, nothing else is written */
+        failed = convert_packages(paths, npaths, &opts);
 
-        if (unpack_archive(payload_file, tmp, true, verbose) != 0) {
-            err(EXIT_FAILURE, "unpack_archive");
+        if (failed && npaths > 1) {
+            warnx(_("*** %zu of %zu packages could not be converted"), failed, npaths);
         }
+    } else if (opts.check) {
+        /* verify each package, nothing is written */
+        failed = extract_batch(paths, npaths, cwd, &opts);
 
-        if (unlink(payload_file) == -1) {
-            err(EXIT_FAILURE, "unlink");
+        if (failed && npaths > 1) {
+            warnx(_("*** %zu of %zu packages failed verification"), failed, npaths);
         }
+    } else if (extract) {
+        /* each package is extracted in to cwd/NEVRA */
+        failed = extract_batch(paths, npaths, cwd, &opts);
 
-        free(payload_file);
-        free(tmp);
-        free(output_dir);
-        headerFree(h);
+        if (failed && npaths > 1) {
+            warnx(_("*** %zu of %zu packages could not be extracted"), failed, npaths);
+        }
     } else if (create) {
         /* XXX: can't create yet */
         printf(_("XXX: unable to create RPMs right now\n"));
 
-        if (verbose) {
+        if (opts.verbose) {
             return EXIT_SUCCESS;
         }
     }
 
     /* Cleanup and exit */
-    free(filename);
+    for (i = 0; i < npaths; i++) {
+        free(paths[i]);
+    }
+
+    free(paths);
     free(cwd);
+    filter_free(filter);
 
-    return EXIT_SUCCESS;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,156 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * User and group name resolution for payload ownership.  Each name is
+ * looked up through NSS once per process and the id is cached, so a
+ * batch of packages sharing the usual handful of owners costs a
+ * handful of lookups no matter how many files they hold.  Unknown
+ * names map to root, as rpm does.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <err.h>
+#include <pwd.h>
+#include <grp.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tarpm.h"
+
+struct idname {
+    char *name;
+    unsigned int id;
+    struct idname *next;
+};
+
+static struct idname *users[OWNER_HASH_SIZE];
+static struct idname *groups[OWNER_HASH_SIZE];
+static pthread_mutex_t owner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t
+name_hash(const char *name)
+{
+    uint32_t h = 2166136261U;
+
+    while (*name != '\0') {
+        h = (h ^ (unsigned char) *name++) * 16777619U;
+    }
+
+    return h % OWNER_HASH_SIZE;
+}
+
+/* Look a name up through NSS.  Returns false if it does not exist. */
+static bool
+resolve(const char *name, const bool group, unsigned int *id)
+{
+    int r = 0;
+    long size = 0;
+    char *buf = NULL;
+    struct passwd pw;
+    struct passwd *pwp = NULL;
+    struct group gr;
+    struct group *grp = NULL;
+
+    size = sysconf(group ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX);
+
+    if (size <= 0) {
+        size = 1024;
+    }
+
+    while (1) {
+        buf = xrealloc(buf, size);
+
+        if (group) {
+            r = getgrnam_r(name, &gr, buf, size, &grp);
+        } else {
+            r = getpwnam_r(name, &pw, buf, size, &pwp);
+        }
+
+        if (r != ERANGE) {
+            break;
+        }
+
+        size *= 2;
+    }
+
+    if (group && grp != NULL) {
+        *id = gr.gr_gid;
+    } else if (!group && pwp != NULL) {
+        *id = pw.pw_uid;
+    }
+
+    free(buf);
+    return group ? (grp != NULL) : (pwp != NULL);
+}
+
+static unsigned int
+lookup(struct idname **table, const char *name, const bool group)
+{
+    size_t h = 0;
+    unsigned int id = 0;
+    struct idname *n = NULL;
+
+    assert(name != NULL);
+
+    h = name_hash(name);
+    pthread_mutex_lock(&owner_lock);
+
+    for (n = table[h]; n != NULL; n = n->next) {
+        if (!strcmp(n->name, name)) {
+            id = n->id;
+            pthread_mutex_unlock(&owner_lock);
+            return id;
+        }
+    }
+
+    if (!resolve(name, group, &id)) {
+        if (group) {
+            warnx(_("*** group %s does not exist, using root"), name);
+        } else {
+            warnx(_("*** user %s does not exist, using root"), name);
+        }
+
+        id = 0;
+    }
+
+    n = xalloc(sizeof(*n));
+    n->name = strdup(name);
+    assert(n->name != NULL);
+    n->id = id;
+    n->next = table[h];
+    table[h] = n;
+
+    pthread_mutex_unlock(&owner_lock);
+    return id;
+}
+
+/* Return the uid of the named user. */
+uid_t
+lookup_uid(const char *name)
+{
+    return lookup(users, name, false);
+}
+
+/* Return the gid of the named group. */
+gid_t
+lookup_gid(const char *name)
+{
+    return lookup(groups, name, true);
+}
+
+/*
+ * Returns true if payload ownership should be restored, which like
+ * tar is only done when running as root.
+ */
+bool
+restore_owner(void)
+{
+    return geteuid() == 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <rpm/header.h>
+
+#include "tarpm.h"
+
+/*
+ * Open the named RPM package and parse the lead, signature, and
+ * header.  A path of "-" reads the package from standard input, which
+ * may be a pipe.  The package is mapped (or, if it cannot be mapped,
+ * read once up to the end of the header, leaving the descriptor at
+ * the start of the payload) and the signature and header are parsed
+ * in place without copying.  Memory use is proportional to the
+ * header size.  The librpm Header is imported from the same bytes.
+ * Returns an allocated struct rpmpkg on success (free with
+ * close_rpm_package()) or NULL if the file cannot be read or is not a
+ * valid RPM.
+ */
+struct rpmpkg *
+open_rpm_package(const char *path)
+{
+    size_t offset = RPMLEAD_SIZE;
+    struct rpmpkg *pkg = NULL;
+
+    assert(path != NULL);
+
+    pkg = xalloc(sizeof(*pkg));
+
+    if (!strcmp(path, "-")) {
+        /* a duplicate, so closing the package leaves stdin open */
+        pkg->path = strdup(_("(standard input)"));
+        pkg->fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    } else {
+        pkg->path = strdup(path);
+        pkg->fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    assert(pkg->path != NULL);
+
+    if (pkg->fd == -1) {
+        warn("open %s", pkg->path);
+        goto bad;
+    }
+
+    if (open_view(pkg->fd, &pkg->view) == -1) {
+        goto bad;
+    }
+
+    /* the lead, signature, and header are consecutive */
+    if (read_lead(&pkg->view, &pkg->lead) == -1) {
+        goto bad;
+    }
+
+    if (read_header_section(&pkg->view, &offset, &pkg->signature, true) == -1) {
+        goto bad;
+    }
+
+    if (read_header_section(&pkg->view, &offset, &pkg->header, false) == -1) {
+        goto bad;
+    }
+
+    /* reading the header may have moved a buffered view */
+    header_section_pointers(&pkg->view, &pkg->signature);
+
+    /* the payload starts immediately after the header */
+    pkg->payload_offset = offset;
+
+    pkg->h = headerImport((void *) header_section_blob(&pkg->view, &pkg->header), pkg->header.svals.hlen + (2 * sizeof(uint32_t)), HEADERIMPORT_COPY);
+
+    if (pkg->h == NULL) {
+        warnx(_("*** unable to import RPM header from %s"), pkg->path);
+        goto bad;
+    }
+
+    /* very old packages need the same retrofitting librpm applies */
+    if (!headerIsEntry(pkg->h, RPMTAG_HEADERIMMUTABLE)) {
+        headerConvert(pkg->h, HEADERCONV_RETROFIT_V3);
+    }
+
+    return pkg;
+
+bad:
+    close_rpm_package(pkg);
+    return NULL;
+}
+
+/*
+ * Close an RPM package opened with open_rpm_package() and free all
+ * memory associated with it.
+ */
+void
+close_rpm_package(struct rpmpkg *pkg)
+{
+    if (pkg == NULL) {
+        return;
+    }
+
+    close_view(&pkg->view);
+
+    if (pkg->fd > -1 && close(pkg->fd) == -1) {
+        warn("close");
+    }
+
+    headerFree(pkg->h);
+    free(pkg->path);
+    free(pkg);
+
+    return;
+}
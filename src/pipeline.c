@@ -0,0 +1,578 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Payload writer pipeline.  The thread reading the payload fills
+ * large chunks with member data and hands them to a pool of writer
+ * threads over single-producer single-consumer rings, so
+ * decompression and file creation overlap.  Each writer thread is a
+ * "lane" with its own disk writer and a fixed set of chunks that
+ * circulate between two rings: the work ring (reader to writer) and
+ * the spare ring (writer back to reader).  The spare ring bounds the
+ * memory in use and makes the reader wait when a lane falls behind.
+ *
+ * All chunks of one member go to the same lane in order.  Members
+ * that share an inode are pinned to the same lane so a hard link is
+ * always written after the file it points to.  Directory metadata is
+ * deferred by the disk writers until every lane has finished.  All
+ * lanes write relative to the same destination directory descriptor.
+ *
+ * Members with an expected digest are hashed by their lane as the data
+ * is written, so verification runs in parallel with decompression.
+ * Without a destination directory the lanes only hash and the member
+ * data is discarded.
+ *
+ * Member data that already sits verbatim in a file, such as in an
+ * uncompressed payload, can be handed over as a range of that file
+ * instead of a buffer.  Writers then move it to the destination in
+ * the kernel and hash it from a mapping of the source.
+ *
+ * With zero threads the same interface writes each member inline on
+ * the calling thread.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <archive_entry.h>
+
+#include "tarpm.h"
+
+/* One unit of work handed from the payload reader to a writer. */
+struct chunk {
+    struct archive_entry *entry;   /* set on the first chunk of a member */
+    long dx;                       /* directory index of the member */
+    bool check;                    /* digest holds the expected digest */
+    struct filedigest digest;
+    char *buf;
+    size_t len;                    /* bytes of member data in buf */
+    bool range;                    /* data is len bytes of srcfd instead */
+    int srcfd;
+    off_t offset;                  /* of the data in srcfd */
+    const uint8_t *map;            /* the same bytes mapped, for hashing */
+    bool last;                     /* final chunk of the member */
+    bool stop;                     /* tells the writer thread to exit */
+};
+
+/* Bounded single-producer single-consumer ring of chunks. */
+struct ring {
+    struct chunk **slots;
+    size_t mask;
+    atomic_size_t head;            /* only advanced by the producer */
+    atomic_size_t tail;            /* only advanced by the consumer */
+    sem_t filled;
+    sem_t empty;
+};
+
+struct lane {
+    pthread_t thread;
+    struct diskw *disk;            /* NULL when discarding */
+    struct ring work;
+    struct ring spare;
+    struct chunk *chunks;
+    bool skip;                     /* current member could not be written */
+    bool check;                    /* current member is being hashed */
+    char *path;                    /* of the member being hashed */
+    struct digest hash;
+    struct filedigest expect;
+    unsigned long errors;
+};
+
+struct pipeline {
+    bool threaded;
+    unsigned int nlanes;
+    unsigned int next;
+    size_t chunksize;
+    struct lane *lanes;
+    struct lane *lane;             /* lane of the member being written */
+    struct chunk *chunk;           /* chunk being filled */
+};
+
+static void
+ring_init(struct ring *r, const size_t size)
+{
+    assert(r != NULL);
+    assert(size > 0 && (size & (size - 1)) == 0);
+
+    r->slots = xcalloc(size, sizeof(*r->slots));
+    r->mask = size - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+
+    if (sem_init(&r->filled, 0, 0) == -1 || sem_init(&r->empty, 0, size) == -1) {
+        err(EXIT_FAILURE, "sem_init");
+    }
+
+    return;
+}
+
+static void
+ring_free(struct ring *r)
+{
+    sem_destroy(&r->filled);
+    sem_destroy(&r->empty);
+    free(r->slots);
+    return;
+}
+
+static void
+sem_wait_intr(sem_t *s)
+{
+    while (sem_wait(s) == -1) {
+        if (errno != EINTR) {
+            err(EXIT_FAILURE, "sem_wait");
+        }
+    }
+
+    return;
+}
+
+static void
+ring_push(struct ring *r, struct chunk *c)
+{
+    size_t head = 0;
+
+    sem_wait_intr(&r->empty);
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    r->slots[head & r->mask] = c;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    sem_post(&r->filled);
+
+    return;
+}
+
+/* Remove the next chunk; the caller already holds a 'filled' count. */
+static struct chunk *
+ring_take(struct ring *r)
+{
+    size_t tail = 0;
+    struct chunk *c = NULL;
+
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    c = r->slots[tail & r->mask];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    sem_post(&r->empty);
+
+    return c;
+}
+
+static struct chunk *
+ring_pop(struct ring *r)
+{
+    sem_wait_intr(&r->filled);
+    return ring_take(r);
+}
+
+static struct chunk *
+ring_trypop(struct ring *r)
+{
+    if (sem_trywait(&r->filled) == -1) {
+        return NULL;
+    }
+
+    return ring_take(r);
+}
+
+static void
+write_header(struct lane *lane, struct archive_entry *entry, const long dx, const struct filedigest *digest)
+{
+    if (lane->disk != NULL && disk_write_header(lane->disk, entry, dx) == -1) {
+        lane->skip = true;
+        lane->errors++;
+        return;
+    }
+
+    if (digest != NULL) {
+        lane->check = true;
+        lane->expect = *digest;
+        digest_init(&lane->hash, digest->algo);
+        lane->path = strdup(archive_entry_pathname(entry));
+        assert(lane->path != NULL);
+    }
+
+    return;
+}
+
+/* Write one chunk of a member on the given lane. */
+static void
+write_chunk(struct lane *lane, struct chunk *c)
+{
+    uint8_t scratch[DIGEST_MAX_SIZE];
+
+    if (c->entry != NULL) {
+        write_header(lane, c->entry, c->dx, c->check ? &c->digest : NULL);
+        archive_entry_free(c->entry);
+        c->entry = NULL;
+    }
+
+    if (c->range) {
+        if (lane->disk != NULL && !lane->skip && c->len > 0 && disk_write_range(lane->disk, c->srcfd, c->offset, c->len) == -1) {
+            lane->skip = true;
+            lane->errors++;
+        }
+
+        if (lane->check && c->len > 0) {
+            digest_update(&lane->hash, c->map, c->len);
+        }
+    } else {
+        if (lane->disk != NULL && !lane->skip && c->len > 0 && disk_write_data(lane->disk, c->buf, c->len) == -1) {
+            lane->skip = true;
+            lane->errors++;
+        }
+
+        if (lane->check && c->len > 0) {
+            digest_update(&lane->hash, c->buf, c->len);
+        }
+    }
+
+    if (c->last) {
+        if (lane->disk != NULL && disk_write_finish(lane->disk) == -1) {
+            lane->errors++;
+        }
+
+        if (lane->check && lane->skip) {
+            /* already reported, just release the digest */
+            digest_final(&lane->hash, scratch);
+        } else if (lane->check && check_file_digest(lane->path, &lane->hash, &lane->expect) == -1) {
+            lane->errors++;
+        }
+
+        if (lane->check) {
+            free(lane->path);
+            lane->path = NULL;
+            lane->check = false;
+        }
+
+        lane->skip = false;
+    }
+
+    c->len = 0;
+    c->range = false;
+    c->last = false;
+    return;
+}
+
+static void *
+writer_thread(void *arg)
+{
+    struct lane *lane = arg;
+    struct chunk *c = NULL;
+
+    while (1) {
+        c = ring_pop(&lane->work);
+
+        if (c->stop) {
+            break;
+        }
+
+        write_chunk(lane, c);
+        ring_push(&lane->spare, c);
+    }
+
+    return NULL;
+}
+
+/*
+ * Choose a lane for a new member and take a spare chunk from it.  A
+ * key of -1 means any lane will do, so prefer one with a chunk ready;
+ * otherwise the member is pinned to the lane the key hashes to.
+ */
+static void
+begin_lane(struct pipeline *pl, const long key)
+{
+    unsigned int i = 0;
+    unsigned int n = 0;
+    struct chunk *c = NULL;
+
+    if (!pl->threaded) {
+        /* the inline writer reuses its only chunk */
+        pl->lane = &pl->lanes[0];
+        pl->chunk = &pl->lane->chunks[0];
+        return;
+    }
+
+    if (key >= 0) {
+        n = (unsigned long) key % pl->nlanes;
+        c = ring_pop(&pl->lanes[n].spare);
+    } else {
+        for (i = 0; i < pl->nlanes && c == NULL; i++) {
+            n = (pl->next + i) % pl->nlanes;
+            c = ring_trypop(&pl->lanes[n].spare);
+        }
+
+        if (c == NULL) {
+            n = pl->next;
+            c = ring_pop(&pl->lanes[n].spare);
+        }
+
+        pl->next = (n + 1) % pl->nlanes;
+    }
+
+    pl->lane = &pl->lanes[n];
+    pl->chunk = c;
+    return;
+}
+
+/* Hand the current chunk to its writer. */
+static void
+flush_chunk(struct pipeline *pl)
+{
+    if (pl->threaded) {
+        ring_push(&pl->lane->work, pl->chunk);
+        pl->chunk = NULL;
+    } else {
+        write_chunk(pl->lane, pl->chunk);
+    }
+
+    return;
+}
+
+/*
+ * Create a payload writer pipeline with nthreads writer threads that
+ * write members below the directory dirfd, whose directories may have
+ * been created as tree (or NULL), under the disk writer rules set by
+ * force and owner.  A dirfd of -1 discards member data after any
+ * digest check.  Zero threads writes members inline.  Chunks handed to
+ * writers hold up to chunksize bytes of member data.  dirfd and tree
+ * must be kept until pipeline_finish() returns.
+ */
+struct pipeline *
+pipeline_new(const unsigned int nthreads, const size_t chunksize, const int dirfd, const struct dirtree *tree, const bool force, const bool owner)
+{
+    unsigned int i = 0;
+    unsigned int j = 0;
+    unsigned int depth = 1;
+    struct lane *lane = NULL;
+    struct pipeline *pl = NULL;
+
+    assert(chunksize > 0);
+
+    pl = xalloc(sizeof(*pl));
+    pl->threaded = (nthreads > 0);
+    pl->nlanes = pl->threaded ? nthreads : 1;
+    pl->chunksize = chunksize;
+    pl->lanes = xcalloc(pl->nlanes, sizeof(*pl->lanes));
+
+    if (pl->threaded) {
+        depth = PIPELINE_DEPTH;
+    }
+
+    for (i = 0; i < pl->nlanes; i++) {
+        lane = &pl->lanes[i];
+
+        if (dirfd >= 0) {
+            lane->disk = disk_writer_new(dirfd, tree, force, owner);
+        }
+
+        lane->chunks = xcalloc(depth, sizeof(*lane->chunks));
+
+        for (j = 0; j < depth; j++) {
+            lane->chunks[j].buf = xalloc(chunksize);
+        }
+
+        if (!pl->threaded) {
+            continue;
+        }
+
+        ring_init(&lane->work, depth);
+        ring_init(&lane->spare, depth);
+
+        for (j = 0; j < depth; j++) {
+            ring_push(&lane->spare, &lane->chunks[j]);
+        }
+
+        if ((errno = pthread_create(&lane->thread, NULL, writer_thread, lane)) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    return pl;
+}
+
+/*
+ * Begin writing a new member described by entry, which lives in
+ * directory dx of the pipeline's tree (or -1 if unknown).  Members
+ * that must be written in order relative to each other (hard links)
+ * pass the same non-negative key; everything else passes -1.  If
+ * digest is not NULL, the member data is checked against it.
+ */
+void
+pipeline_begin(struct pipeline *pl, struct archive_entry *entry, const long key, const long dx, const struct filedigest *digest)
+{
+    assert(pl != NULL);
+    assert(entry != NULL);
+    assert(pl->chunk == NULL || !pl->threaded);
+
+    begin_lane(pl, key);
+
+    if (pl->threaded) {
+        pl->chunk->entry = archive_entry_clone(entry);
+        assert(pl->chunk->entry != NULL);
+        pl->chunk->dx = dx;
+        pl->chunk->check = (digest != NULL);
+
+        if (digest != NULL) {
+            pl->chunk->digest = *digest;
+        }
+    } else {
+        write_header(pl->lane, entry, dx, digest);
+    }
+
+    return;
+}
+
+/*
+ * Return space in the current chunk for member data and store the
+ * number of bytes available in avail.  Fill it and then call
+ * pipeline_commit() with the number of bytes written.
+ */
+char *
+pipeline_buffer(struct pipeline *pl, size_t *avail)
+{
+    struct ring *spare = NULL;
+
+    assert(pl != NULL);
+    assert(pl->chunk != NULL);
+    assert(avail != NULL);
+
+    if (pl->chunk->len == pl->chunksize) {
+        /* full, so pass it on and continue the member in a new chunk */
+        spare = &pl->lane->spare;
+        flush_chunk(pl);
+
+        if (pl->threaded) {
+            pl->chunk = ring_pop(spare);
+        }
+    }
+
+    *avail = pl->chunksize - pl->chunk->len;
+    return pl->chunk->buf + pl->chunk->len;
+}
+
+void
+pipeline_commit(struct pipeline *pl, const size_t len)
+{
+    assert(pl != NULL);
+    assert(pl->chunk != NULL);
+    assert(pl->chunk->len + len <= pl->chunksize);
+
+    pl->chunk->len += len;
+    return;
+}
+
+/*
+ * Supply all of the current member's data as len bytes of srcfd at
+ * offset, which are also mapped at map.  Use instead of
+ * pipeline_buffer() and pipeline_commit(), then call pipeline_end().
+ * srcfd and the mapping must be kept until pipeline_finish() returns.
+ */
+void
+pipeline_range(struct pipeline *pl, const int srcfd, const off_t offset, const uint8_t *map, const size_t len)
+{
+    assert(pl != NULL);
+    assert(pl->chunk != NULL);
+    assert(pl->chunk->len == 0);
+    assert(srcfd >= 0);
+    assert(map != NULL || len == 0);
+
+    pl->chunk->range = true;
+    pl->chunk->srcfd = srcfd;
+    pl->chunk->offset = offset;
+    pl->chunk->map = map;
+    pl->chunk->len = len;
+    return;
+}
+
+/*
+ * Finish the current member.
+ */
+void
+pipeline_end(struct pipeline *pl)
+{
+    assert(pl != NULL);
+    assert(pl->chunk != NULL);
+
+    pl->chunk->last = true;
+    flush_chunk(pl);
+    return;
+}
+
+/*
+ * Wait for all writers to finish, apply deferred directory metadata,
+ * and free the pipeline.  Returns 0 if every member was written, -1
+ * otherwise.
+ */
+int
+pipeline_finish(struct pipeline *pl)
+{
+    unsigned int i = 0;
+    unsigned int j = 0;
+    unsigned int depth = 1;
+    unsigned long errors = 0;
+    struct lane *lane = NULL;
+    struct chunk *c = NULL;
+    struct diskw **disks = NULL;
+
+    if (pl == NULL) {
+        return 0;
+    }
+
+    if (pl->threaded) {
+        depth = PIPELINE_DEPTH;
+
+        for (i = 0; i < pl->nlanes; i++) {
+            c = ring_pop(&pl->lanes[i].spare);
+            c->stop = true;
+            ring_push(&pl->lanes[i].work, c);
+        }
+
+        for (i = 0; i < pl->nlanes; i++) {
+            if ((errno = pthread_join(pl->lanes[i].thread, NULL)) != 0) {
+                warn("pthread_join");
+            }
+        }
+    }
+
+    /* every lane is idle, so directory fixups cannot race file writes */
+    disks = xcalloc(pl->nlanes, sizeof(*disks));
+
+    for (i = 0; i < pl->nlanes; i++) {
+        disks[i] = pl->lanes[i].disk;
+    }
+
+    if (pl->lanes[0].disk != NULL && disk_writers_close(disks, pl->nlanes) == -1) {
+        errors++;
+    }
+
+    free(disks);
+
+    for (i = 0; i < pl->nlanes; i++) {
+        lane = &pl->lanes[i];
+        errors += lane->errors;
+
+        for (j = 0; j < depth; j++) {
+            archive_entry_free(lane->chunks[j].entry);
+            free(lane->chunks[j].buf);
+        }
+
+        free(lane->chunks);
+
+        if (pl->threaded) {
+            ring_free(&lane->work);
+            ring_free(&lane->spare);
+        }
+    }
+
+    free(pl->lanes);
+    free(pl);
+
+    return (errors == 0) ? 0 : -1;
+}
@@ -5,25 +5,131 @@
 
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "tarpm.h"
 
 /*
- * Given a "signature" or "header" header, compute the values necessary
- * to iterate over it.  Return the computed values as a struct that the
- * caller must free.
+ * Open a read-only view of the package on fd.  Regular files are
+ * mapped in place so the signature and header are parsed without
+ * copying.  Anything that cannot be mapped is read in to a buffer on
+ * demand by view_need().  Returns 0 on success, -1 on error.
  */
-struct rpmsigvalues *
-compute_sigvalues(const struct rpmsignature *sig, const bool signature)
+int
+open_view(const int fd, struct rpmview *view)
 {
-    struct rpmsigvalues *vals = NULL;
+    struct stat sb;
 
-    assert(sig != NULL);
+    assert(fd >= 0);
+    assert(view != NULL);
+
+    memset(view, 0, sizeof(*view));
+    view->fd = fd;
+
+    if (fstat(fd, &sb) == -1) {
+        warn("fstat");
+        return -1;
+    }
+
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        view->data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (view->data != MAP_FAILED) {
+            view->mapped = true;
+            view->len = view->size = sb.st_size;
+            return 0;
+        }
+
+        view->data = NULL;
+    }
+
+    return 0;
+}
+
+/*
+ * Make sure at least len bytes from the start of the package are in
+ * the view.  Unmapped views read exactly what is missing so the file
+ * offset ends where the parser stopped.  Returns 0 on success, -1 if
+ * the package is shorter than len.
+ */
+int
+view_need(struct rpmview *view, const size_t len)
+{
+    ssize_t r = 0;
+
+    assert(view != NULL);
+
+    if (len <= view->len) {
+        return 0;
+    }
+
+    if (view->mapped) {
+        warnx(_("*** unexpected end of file"));
+        return -1;
+    }
+
+    if (len > view->size) {
+        view->size = (len > view->size * 2) ? len : view->size * 2;
+        view->data = xrealloc(view->data, view->size);
+    }
 
-    vals = calloc(1, sizeof(*vals));
+    while (view->len < len) {
+        r = read(view->fd, view->data + view->len, len - view->len);
+
+        if (r == -1 && errno == EINTR) {
+            continue;
+        } else if (r == -1) {
+            warn("read");
+            return -1;
+        } else if (r == 0) {
+            warnx(_("*** unexpected end of file"));
+            return -1;
+        }
+
+        view->len += r;
+    }
+
+    return 0;
+}
+
+/*
+ * Release a view opened with open_view().  The file descriptor is
+ * left open.
+ */
+void
+close_view(struct rpmview *view)
+{
+    if (view == NULL) {
+        return;
+    }
+
+    if (view->mapped) {
+        if (munmap(view->data, view->size) == -1) {
+            warn("munmap");
+        }
+    } else {
+        free(view->data);
+    }
+
+    memset(view, 0, sizeof(*view));
+    return;
+}
+
+/*
+ * Given a "signature" or "header" header, compute the values necessary
+ * to iterate over it and store them in vals.
+ */
+void
+compute_sigvalues(const struct rpmsignature *sig, const bool signature, struct rpmsigvalues *vals)
+{
+    assert(sig != NULL);
     assert(vals != NULL);
 
+    memset(vals, 0, sizeof(*vals));
+
     /* computed from header values */
     vals->ilen = sig->nentries * sizeof(struct rpmidxentry);
     vals->hlen = vals->ilen + sig->nbytes;
@@ -33,110 +139,246 @@ compute_sigvalues(const struct rpmsignature *sig, const bool signature)
         vals->padlen = (8 - (vals->hlen % 8)) % 8;
     }
 
-    return vals;
+    return;
 }
 
 /*
- * Read the intro part of a "signature" or "header" header.  These are
- * structurally the same, but contain different data.  Returns an
- * allocated struct rpmhdrintro on success (caller must free) or NULL
- * on error.
+ * Read the intro part of a "signature" or "header" header at offset
+ * in the view.  These are structurally the same, but contain
+ * different data.  Returns 0 on success or -1 if the intro cannot be
+ * read or is not valid.
  */
-struct rpmsignature *
-read_header_signature(const int fd)
+int
+read_header_signature(struct rpmview *view, const size_t offset, struct rpmsignature *sig)
 {
-    struct rpmsignature *sig = NULL;
-
-    assert(fd > 0);
-
-    /* zero out the structures */
-    sig = xcalloc(1, sizeof(*sig));
+    assert(view != NULL);
     assert(sig != NULL);
 
-    /* read in the signature */
-    if (read(fd, sig, RPMHDRINTROSZ) != RPMHDRINTROSZ) {
-        warn("read");
-        goto bad;
+    if (view_need(view, offset + RPMHDRINTROSZ) == -1) {
+        return -1;
     }
 
+    memcpy(sig, view->data + offset, RPMHDRINTROSZ);
     sig->magic = ntohl(sig->magic);
     sig->nentries = ntohl(sig->nentries);
     sig->nbytes = ntohl(sig->nbytes);
 
     /* verify the magic and reserved values are correct */
     if (sig->magic != RPM_SIGNATURE_MAGIC) {
-        warn("magic value mismatch, not an RPM");
-        goto bad;
+        warnx(_("*** magic value mismatch, not an RPM"));
+        return -1;
     }
 
     if (sig->reserved != 0) {
-        warn("reserved value mismatch, not an RPM");
-        goto bad;
+        warnx(_("*** reserved value mismatch, not an RPM"));
+        return -1;
     }
 
-    return sig;
+    /* same sanity limits librpm applies */
+    if (sig->nentries == 0 || sig->nentries > RPM_MAX_INDEX_ENTRIES || sig->nbytes > RPM_MAX_DATA_SIZE) {
+        warnx(_("*** header size out of range, not an RPM"));
+        return -1;
+    }
 
-bad:
-    free(sig);
-    return NULL;
+    return 0;
 }
 
 /*
- * Given a header sig structure, read the entries block in to a
- * buffer for random access.  Returns an allocated buffer with the
- * data in it, or NULL on error.  The caller is responsible for
- * freeing the buffer.
+ * Size in bytes of one element of a fixed size data type, or 0 for
+ * the variable length types.
  */
-uint32_t *
-read_header_entries(const int fd, const struct rpmsignature *sig, const uint32_t hlen)
+static size_t
+type_size(const rpmTagType type)
 {
-    uint32_t *buffer = NULL;
+    switch (type) {
+        case RPM_CHAR_TYPE:
+        case RPM_INT8_TYPE:
+            return 1;
+        case RPM_INT16_TYPE:
+            return 2;
+        case RPM_INT32_TYPE:
+            return 4;
+        case RPM_INT64_TYPE:
+            return 8;
+        default:
+            return 0;
+    }
+}
 
-    assert(fd > 0);
-    assert(sig != NULL);
-    assert(hlen > 0);
+/*
+ * Check that the data of an index entry lies entirely inside the data
+ * store.  Everything that reads entry data later relies on this.
+ * Returns true if the entry is safe to read.
+ */
+static bool
+entry_in_bounds(const struct rpmsignature *sig, const struct rpmsigvalues *svals, const struct rpmidxentry *entry)
+{
+    uint32_t i = 0;
+    rpmTagType type = ntohl(entry->type);
+    uint32_t count = ntohl(entry->count);
+    int32_t offset = ntohl(entry->offset);
+    size_t avail = 0;
+    const uint8_t *p = NULL;
+    const uint8_t *nul = NULL;
+
+    if (offset < 0 || (uint32_t) offset > sig->nbytes) {
+        return false;
+    }
 
-    /* read in entries */
-    /* (largely from rpmdump.c) */
-    buffer = xcalloc(sig->nentries, sig->nbytes + hlen);
-    assert(buffer != NULL);
+    avail = sig->nbytes - offset;
+    p = svals->datastart + offset;
+
+    switch (type) {
+        case RPM_NULL_TYPE:
+            return true;
+        case RPM_CHAR_TYPE:
+        case RPM_INT8_TYPE:
+        case RPM_INT16_TYPE:
+        case RPM_INT32_TYPE:
+        case RPM_INT64_TYPE:
+            return ((uint64_t) count * type_size(type)) <= avail;
+        case RPM_BIN_TYPE:
+            return count <= avail;
+        case RPM_STRING_TYPE:
+            return memchr(p, '\0', avail) != NULL;
+        case RPM_STRING_ARRAY_TYPE:
+        case RPM_I18NSTRING_TYPE:
+            for (i = 0; i < count; i++) {
+                nul = memchr(p, '\0', avail);
+
+                if (nul == NULL) {
+                    return false;
+                }
+
+                avail -= (nul - p) + 1;
+                p = nul + 1;
+            }
+
+            return true;
+        default:
+            /* unknown types are reported but never decoded */
+            return true;
+    }
+}
+
+/*
+ * Read the RPM lead at the start of the view in to lead and convert
+ * the fields from network byte order.  Returns 0 on success, -1 on
+ * error.
+ */
+int
+read_lead(struct rpmview *view, struct rpmlead *lead)
+{
+    static const unsigned char magic[] = { 0xED, 0xAB, 0xEE, 0xDB };
 
-    buffer[0] = htonl(sig->nentries);
-    buffer[1] = htonl(sig->nbytes);
+    assert(view != NULL);
+    assert(lead != NULL);
 
-    if (read(fd, buffer + 2, hlen) != hlen) {
-        warn("read");
-        free(buffer);
-        return NULL;
+    if (view_need(view, RPMLEAD_SIZE) == -1) {
+        return -1;
     }
 
-    return buffer;
+    memcpy(lead, view->data, RPMLEAD_SIZE);
+
+    if (memcmp(lead->magic, magic, sizeof(magic))) {
+        warnx(_("*** lead magic value mismatch, not an RPM"));
+        return -1;
+    }
+
+    /* convert some lead fields from network byte order to host byte order */
+    lead->type = ntohs(lead->type);
+    lead->osnum = ntohs(lead->osnum);
+    lead->archnum = ntohs(lead->archnum);
+    lead->signature_type = ntohs(lead->signature_type);
+
+    return 0;
 }
 
 /*
- * Read and return the trailer if necessary.  Caller is responsible
- * for freeing the allocated trailer.
+ * Parse a complete "signature" or "header" section starting at
+ * *offset in the view.  Nothing is copied: the index entries and data
+ * store are accessed in place through section->svals, and every entry
+ * is bounds checked against the data store here.  On success *offset
+ * is advanced past the section (including the signature's alignment
+ * padding) and 0 is returned.  Returns -1 on error.
  */
-struct rpmidxentry *
-read_header_trailer(const struct rpmidxentry *entry, const uint8_t *datastart)
+int
+read_header_section(struct rpmview *view, size_t *offset, struct rpmsection *section, const bool signature)
 {
-    struct rpmidxentry *trailer = NULL;
-    rpmSigTag tag = 0;
+    uint32_t i = 0;
 
-    assert(entry != NULL);
-    assert(datastart != NULL);
+    assert(view != NULL);
+    assert(offset != NULL);
+    assert(section != NULL);
 
-    tag = ntohl(entry->tag);
+    memset(section, 0, sizeof(*section));
+    section->offset = *offset;
 
-    if (tag == HEADER_SIGNATURES || tag == HEADER_IMMUTABLE) {
-        trailer = xalloc(sizeof(*trailer));
-        assert(trailer != NULL);
-        memcpy(trailer, datastart + ntohl(entry->offset), sizeof(*trailer));
+    /* read in the signature */
+    if (read_header_signature(view, *offset, &section->sig) == -1) {
+        return -1;
     }
 
-    return trailer;
+    /* computed from header values */
+    compute_sigvalues(&section->sig, signature, &section->svals);
+
+    /* the entries and data store, plus any padding, must be present */
+    if (view_need(view, *offset + RPMHDRINTROSZ + section->svals.hlen + section->svals.padlen) == -1) {
+        return -1;
+    }
+
+    header_section_pointers(view, section);
+
+    for (i = 0; i < section->sig.nentries; i++) {
+        if (!entry_in_bounds(&section->sig, &section->svals, &section->svals.estart[i])) {
+            warnx(_("*** index entry %u is out of bounds, not a valid RPM"), i);
+            return -1;
+        }
+
+        /* the tag table knows what type most header tags must be */
+        if (!signature && !tag_type_valid(ntohl(section->svals.estart[i].tag), ntohl(section->svals.estart[i].type), ntohl(section->svals.estart[i].count))) {
+            warnx(_("*** index entry %u has the wrong type for its tag, not a valid RPM"), i);
+            return -1;
+        }
+    }
+
+    *offset += RPMHDRINTROSZ + section->svals.hlen + section->svals.padlen;
+    return 0;
 }
 
+/*
+ * Point the computed values of a section at its index entries and
+ * data store in the view.  A view that is read in to a buffer may
+ * move as it grows, so call this again for earlier sections once all
+ * of them have been read.
+ */
+void
+header_section_pointers(const struct rpmview *view, struct rpmsection *section)
+{
+    assert(view != NULL);
+    assert(section != NULL);
+
+    section->svals.estart = (const struct rpmidxentry *) (view->data + section->offset + RPMHDRINTROSZ);
+    section->svals.datastart = (const uint8_t *) (section->svals.estart + section->sig.nentries);
+    return;
+}
+
+/*
+ * Return a pointer to the blob librpm's headerImport() expects for a
+ * section: the entry count and data size followed by the index and
+ * data store.  This points in to the view.
+ */
+const void *
+header_section_blob(const struct rpmview *view, const struct rpmsection *section)
+{
+    assert(view != NULL);
+    assert(section != NULL);
+
+    /* skip the magic and reserved words of the intro */
+    return view->data + section->offset + (2 * sizeof(uint32_t));
+}
+
+
 
 
 
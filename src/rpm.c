@@ -3,15 +3,16 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <err.h>
 #include <archive.h>
 #include <archive_entry.h>
 #include <rpm/rpmlib.h>
 #include <rpm/header.h>
-#include <rpm/rpmts.h>
-#include <rpm/rpmlib.h>
 
 #include "tarpm.h"
 
@@ -36,212 +37,910 @@ struct archive *new_archive_reader(void)
 */
 
 /*
- * Given a path to an RPM package, extract the payload to a tar file
- * for later use with extract_rpm().  This happens in cases where
- * libarchive cannot detect the cpio stream in an opened RPM file.
- * The caller must free the returned path string.
- *
- * A lot of this is adapted from rpm2archive.c from the rpm sources.
+ * Where payload members come from: for an uncompressed payload the
+ * archive read in place so member data can be moved straight from
+ * the package, for xz, zstd, and gzip in a mapped package the archive
+ * streamed from the native decoder, and for anything else librpm's
+ * archive reader, which decompresses the payload through rpmio.
  */
-char *
-extract_rpm_payload(const char *rpm)
+struct payload {
+    const struct rpmpkg *pkg;
+    rpmfiles files;
+    FD_t gzdi;
+    rpmfi fi;                      /* librpm's reader, or NULL */
+    struct decoder *dec;           /* native decoder, or NULL */
+    struct cpiostream stream;
+    struct cpioreader cpio;
+    int fx;                        /* current member */
+    size_t offset;                 /* of its data in the package, in place */
+    uint64_t size;
+};
+
+/*
+ * Create every directory listed in the package's DIRNAMES below dirfd
+ * in one pass, before any payload member is written, and return the
+ * tree for the disk writers to create members from.  When only some
+ * files are selected, only the directories holding them are created.
+ */
+static struct dirtree *
+payload_dirtree(rpmfiles files, const int dirfd, const bool *selected)
+{
+    int i = 0;
+    int dx = 0;
+    int ndirs = rpmfilesDC(files);
+    int nfiles = rpmfilesFC(files);
+    const char **dirnames = NULL;
+    uint32_t *counts = NULL;
+    struct dirtree *tree = NULL;
+
+    if (ndirs <= 0) {
+        return dirtree_new(dirfd, NULL, 0, NULL);
+    }
+
+    dirnames = xcalloc(ndirs, sizeof(*dirnames));
+    counts = xcalloc(ndirs, sizeof(*counts));
+
+    for (i = 0; i < ndirs; i++) {
+        dirnames[i] = rpmfilesDN(files, i);
+    }
+
+    /* DIRINDEXES, to find the busiest directories */
+    for (i = 0; i < nfiles; i++) {
+        dx = rpmfilesDI(files, i);
+
+        if (dx >= 0 && dx < ndirs && (selected == NULL || selected[i])) {
+            counts[dx]++;
+        }
+    }
+
+    if (selected != NULL) {
+        for (i = 0; i < ndirs; i++) {
+            if (counts[i] == 0) {
+                dirnames[i] = NULL;
+            }
+        }
+    }
+
+    tree = dirtree_new(dirfd, dirnames, ndirs, counts);
+    free(counts);
+    free(dirnames);
+
+    return tree;
+}
+
+/*
+ * Resolve the owner and group of every file in the package, indexed
+ * by file.  The names come from FILEUSERNAME and FILEGROUPNAME, where
+ * they repeat heavily, so a name only goes to the lookup cache when
+ * it differs from the one before.  The caller frees both arrays.
+ */
+static void
+payload_owners(rpmfiles files, uid_t **uids, gid_t **gids)
+{
+    int i = 0;
+    int nfiles = rpmfilesFC(files);
+    const char *name = NULL;
+    const char *user = NULL;
+    const char *group = NULL;
+    uid_t uid = 0;
+    gid_t gid = 0;
+
+    *uids = xcalloc((nfiles > 0) ? nfiles : 1, sizeof(**uids));
+    *gids = xcalloc((nfiles > 0) ? nfiles : 1, sizeof(**gids));
+
+    for (i = 0; i < nfiles; i++) {
+        name = rpmfilesFUser(files, i);
+
+        if (name != NULL && (user == NULL || strcmp(name, user))) {
+            uid = lookup_uid(name);
+            user = name;
+        }
+
+        name = rpmfilesFGroup(files, i);
+
+        if (name != NULL && (group == NULL || strcmp(name, group))) {
+            gid = lookup_gid(name);
+            group = name;
+        }
+
+        (*uids)[i] = uid;
+        (*gids)[i] = gid;
+    }
+
+    return;
+}
+
+/*
+ * Return a file linked to the hard link set of file fx that is
+ * selected, or -1 if there is none.
+ */
+static int
+selected_link(rpmfiles files, const bool *selected, const int fx)
+{
+    const int *links = NULL;
+    uint32_t nlinks = 0;
+    uint32_t i = 0;
+
+    nlinks = rpmfilesFLinks(files, fx, &links);
+
+    for (i = 0; i < nlinks; i++) {
+        if (selected[links[i]]) {
+            return links[i];
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Decide which files to extract from opts->filter.  %ghost files are
+ * never in the payload, so they are dropped from the count that ends
+ * reading early.  Returns true if a named member was not found.
+ */
+static bool
+payload_selection(const struct filter *filter, rpmfiles files, const char *path, bool **selected, size_t *remaining)
+{
+    int i = 0;
+    int nfiles = rpmfilesFC(files);
+    bool missing = false;
+
+    missing = filter_files(filter, files, path, selected, remaining) == -1;
+
+    for (i = 0; i < nfiles; i++) {
+        if ((*selected)[i] && (rpmfilesFFlags(files, i) & RPMFILE_GHOST)) {
+            (*selected)[i] = false;
+            (*remaining)--;
+        }
+    }
+
+    return missing;
+}
+
+/*
+ * Open the payload of pkg.  An uncompressed payload is read in place
+ * from the mapped package, xz and zstd payloads and large gzip
+ * payloads in a mapped package are decompressed natively with up to
+ * threads threads, and anything else goes through librpm's archive
+ * reader.  The payload is hashed in to pd as it is read when pd needs
+ * that.  Returns 0 on success, -1 on error after reporting it.
+ */
+static int
+payload_open(struct payload *p, const struct rpmpkg *pkg, rpmfiles files, const unsigned int threads, struct paydigest *pd)
 {
-    char *payload = NULL;
-    rpmts ts;
-    rpmVSFlags vsflags = RPMVSF_MASK_NODIGESTS | RPMVSF_MASK_NOSIGNATURES | RPMVSF_NOHDRCHK;
-    Header hdr = NULL;
     FD_t fdi = NULL;
-    FD_t gzdi = NULL;
+    int fd = -1;
     const char *compr = NULL;
     char *rpmio_flags = NULL;
-    rpmfiles files = NULL;
-    rpmfi fi = NULL;
-    struct archive *archive = NULL;
-    struct archive_entry *entry = NULL;
-    char *buf = NULL;
-    char *hardlink = NULL;
-    rpm_mode_t mode = 0;
-    int nlink = 0;
-    int rc = 0;
-    const char *dn = NULL;
-    char *filename = NULL;
-    rpm_loff_t left;
-    size_t len = 0;
-    size_t read = 0;
 
-    assert(rpm != NULL);
+    memset(p, 0, sizeof(*p));
+    p->pkg = pkg;
+    p->files = files;
+
+    if (cpio_payload(pkg)) {
+        cpio_begin(pkg, &p->cpio);
+        return 0;
+    }
+
+    if ((p->dec = decoder_open(pkg, threads)) != NULL) {
+        payload_digest_decoder(pd, p->dec);
+        cpio_stream_begin(&p->stream, p->dec);
+        return 0;
+    }
+
+    /*
+     * position the package at the start of the payload; a package that
+     * is not mapped, such as a pipe, was read exactly that far
+     */
+    if (pkg->view.mapped && lseek(pkg->fd, pkg->payload_offset, SEEK_SET) == -1) {
+        warn("lseek");
+        return -1;
+    }
+
+    fd = payload_digest_fd(pkg, pd);
 
-    /* create librpm widgets */
-    ts = rpmtsCreate();
-    rpmtsSetVSFlags(ts, vsflags);
+    if (fd == -1) {
+        return -1;
+    }
 
-    /* open the package */
-    fdi = Fopen(rpm, "r.ufdio");
-    rc = rpmReadPackageFile(ts, fdi, COMMAND_NAME, &hdr);
+    fdi = fdDup(fd);
 
-    if (rc == RPMRC_NOTFOUND || rc == RPMRC_FAIL) {
-        warn("*** rpmReadPackageFile");
-        goto cleanup;
+    if (fdi == NULL) {
+        warn("fdDup");
+        return -1;
     }
 
     /* determine how to read the payload */
-    compr = headerGetString(hdr, RPMTAG_PAYLOADCOMPRESSOR);
+    compr = headerGetString(pkg->h, RPMTAG_PAYLOADCOMPRESSOR);
     xasprintf(&rpmio_flags, "r.%s", compr ? compr : "gzip");
     assert(rpmio_flags != NULL);
 
     /* open the payload */
-    gzdi = Fdopen(fdi, rpmio_flags);
+    p->gzdi = Fdopen(fdi, rpmio_flags);
     free(rpmio_flags);
 
-    if (gzdi == NULL) {
-        warnx("*** Fdopen: %s", Fstrerror(gzdi));
-        goto cleanup;
+    if (p->gzdi == NULL) {
+        warnx("*** Fdopen: %s", Fstrerror(fdi));
+        Fclose(fdi);
+        return -1;
+    }
+
+    p->fi = rpmfiNewArchiveReader(p->gzdi, files, RPMFI_ITER_READ_ARCHIVE_CONTENT_FIRST);
+    return 0;
+}
+
+/*
+ * Move to the next member of the payload.  Returns its file index,
+ * RPMERR_ITER_END at the end of the payload, or another negative
+ * value on error.
+ */
+static int
+payload_next(struct payload *p)
+{
+    int r = 0;
+
+    if (p->fi != NULL) {
+        p->fx = rpmfiNext(p->fi);
+        return p->fx;
+    } else if (p->dec != NULL) {
+        r = cpio_stream_next(&p->stream, p->files, &p->fx, &p->size);
+    } else {
+        r = cpio_next(&p->cpio, p->files, &p->fx, &p->offset, &p->size);
+    }
+
+    return (r == 1) ? p->fx : (r == 0) ? RPMERR_ITER_END : -1;
+}
+
+/* True if the current member carries the content of a regular file. */
+static bool
+payload_has_content(const struct payload *p)
+{
+    const int *links = NULL;
+    uint32_t nlinks = 0;
+
+    if (p->fi != NULL) {
+        return rpmfiArchiveHasContent(p->fi);
+    }
+
+    /* a hard link set's content is on its last member */
+    if (!S_ISREG(rpmfilesFMode(p->files, p->fx))) {
+        return false;
+    }
+
+    nlinks = rpmfilesFLinks(p->files, p->fx, &links);
+    return nlinks <= 1 || links[nlinks - 1] == p->fx;
+}
+
+/*
+ * Package offset up to which the payload has been read, for hashing
+ * it behind the reader.  librpm's reader uses a duplicate of the
+ * package descriptor, so the shared file offset says how far it got.
+ */
+static size_t
+payload_position(const struct payload *p)
+{
+    off_t pos = 0;
+
+    if (p->dec != NULL) {
+        return decoder_position(p->dec);
+    } else if (p->fi == NULL) {
+        return p->cpio.base + p->cpio.offset;
+    }
+
+    pos = lseek(p->pkg->fd, 0, SEEK_CUR);
+    return (pos == -1) ? 0 : pos;
+}
+
+/*
+ * Read up to len bytes of the current member's data in to buf from a
+ * decompressed payload.  Returns the number of bytes read, or -1.
+ */
+static ssize_t
+payload_read(struct payload *p, void *buf, const size_t len)
+{
+    if (p->dec != NULL) {
+        return cpio_stream_read(&p->stream, buf, len);
+    }
+
+    return rpmfiArchiveRead(p->fi, buf, len);
+}
+
+/*
+ * Hand size bytes of the current member's data to the pipeline.  Data
+ * read in place is passed as a range of the package so it is moved in
+ * the kernel; decompressed data is read in to pipeline buffers.
+ * Returns 0 on success, -1 on error after reporting it.
+ */
+static int
+payload_copy(struct payload *p, struct pipeline *pl, const rpm_loff_t size)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    rpm_loff_t left = size;
+
+    if (p->fi == NULL && p->size != size) {
+        warnx(_("*** error reading file from RPM payload"));
+        return -1;
+    }
+
+    if (p->fi == NULL && p->dec == NULL) {
+        pipeline_range(pl, p->pkg->fd, p->offset, p->pkg->view.data + p->offset, size);
+        return 0;
+    }
+
+    while (left) {
+        buf = pipeline_buffer(pl, &len);
+        len = (left > len ? len : left);
+
+        if (payload_read(p, buf, len) != (ssize_t) len) {
+            warnx(_("*** error reading file from RPM payload"));
+            return -1;
+        }
+
+        pipeline_commit(pl, len);
+        left -= len;
+    }
+
+    return 0;
+}
+
+static void
+payload_close(struct payload *p)
+{
+    if (p->gzdi != NULL) {
+        Fclose(p->gzdi);
+    }
+
+    rpmfiFree(p->fi);
+    decoder_close(p->dec);
+    return;
+}
+
+/*
+ * Describe file fx of the package in entry, with uid and gid taken
+ * from the resolved owners when owner is set.  Returns the file's
+ * path, which the caller frees.
+ */
+static char *
+member_entry(struct archive_entry *entry, rpmfiles files, const int fx, const bool owner, const uid_t *uids, const gid_t *gids)
+{
+    char *filename = NULL;
+    rpm_mode_t mode = rpmfilesFMode(files, fx);
+
+    filename = rpmfilesFN(files, fx);
+    assert(filename != NULL);
+
+    /* member paths are relative to dest */
+    archive_entry_clear(entry);
+    archive_entry_copy_pathname(entry, filename + strspn(filename, "/"));
+    archive_entry_set_size(entry, rpmfilesFSize(files, fx));
+    archive_entry_set_filetype(entry, mode & S_IFMT);
+    archive_entry_set_perm(entry, mode);
+
+    if (owner) {
+        archive_entry_set_uid(entry, uids[fx]);
+        archive_entry_set_gid(entry, gids[fx]);
+    }
+
+    archive_entry_set_rdev(entry, rpmfilesFRdev(files, fx));
+    archive_entry_set_mtime(entry, rpmfilesFMtime(files, fx), 0);
+
+    if (S_ISLNK(mode)) {
+        archive_entry_set_symlink(entry, rpmfilesFLink(files, fx));
+    }
+
+    return filename;
+}
+
+/*
+ * Extract the payload of an opened RPM package in to the dest
+ * directory, which must already exist.  The payload is decompressed
+ * once, from the offset found when the package was opened, and each
+ * file is handed to the payload writer pipeline as it is read.
+ * opts->filter selects the members written and opts->verify checks
+ * them against the header's digests.  A NULL dest only checks the
+ * payload and writes nothing.  Returns 0 on success, -1 on error.
+ *
+ * A lot of this is adapted from rpm2archive.c from the rpm sources.
+ */
+int
+extract_rpm_payload(const struct rpmpkg *pkg, const char *dest, const struct tarpmopts *opts)
+{
+    int ret = 0;
+    int dirfd = -1;
+    int rc = 0;
+    int fx = 0;
+    int target = 0;
+    int algo = 0;
+    uint32_t i = 0;
+    uint32_t nlinks = 0;
+    const int *links = NULL;
+    rpmfiles files = NULL;
+    struct payload src;
+    struct pipeline *pl = NULL;
+    struct dirtree *tree = NULL;
+    bool owner = false;
+    uid_t *uids = NULL;
+    gid_t *gids = NULL;
+    bool *selected = NULL;
+    bool missing = false;
+    size_t remaining = 0;
+    struct paydigest pd;
+    struct filedigest digest;
+    const unsigned char *fdigest = NULL;
+    size_t diglen = 0;
+    bool check = false;
+    struct archive_entry *entry = NULL;
+    rpm_mode_t mode = 0;
+    long key = -1;
+    char *filename = NULL;
+    char *linkname = NULL;
+    const char *member = NULL;
+
+    assert(pkg != NULL);
+    assert(opts != NULL);
+
+    memset(&pd, 0, sizeof(pd));
+
+    /* members are created relative to this */
+    if (dest != NULL) {
+        dirfd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (dirfd == -1) {
+            warn("open %s", dest);
+            return -1;
+        }
     }
 
-    files = rpmfilesNew(NULL, hdr, 0, RPMFI_KEEPHEADER);
-    fi = rpmfiNewArchiveReader(gzdi, files, RPMFI_ITER_READ_ARCHIVE_CONTENT_FIRST);
+    files = rpmfilesNew(NULL, pkg->h, 0, RPMFI_KEEPHEADER);
+
+    if (opts->verify) {
+        payload_digest_begin(pkg, &pd);
+    }
 
-    /* create a new archive with the payload data */
-    archive = archive_write_new();
+    if (payload_open(&src, pkg, files, opts->decoders, &pd) == -1) {
+        payload_digest_cancel(&pd);
+        rpmfilesFree(files);
 
-    if (archive_write_add_filter_gzip(archive) != ARCHIVE_OK) {
-        warnx("*** archive_write_add_filter_gzip: %s", archive_error_string(archive));
-        goto cleanup;
+        if (dirfd != -1) {
+            close(dirfd);
+        }
+
+        return -1;
     }
 
-    if (archive_write_set_format_pax_restricted(archive) != ARCHIVE_OK) {
-        warnx("*** archive_write_set_format_pax_restricted: %s", archive_error_string(archive));
-        goto cleanup;
+    /* decided from the header, before any of the payload is read */
+    if (opts->filter != NULL) {
+        missing = payload_selection(opts->filter, files, pkg->path, &selected, &remaining);
     }
 
-    xasprintf(&payload, "%s.tar", rpm);
-    assert(payload != NULL);
+    /* payload members are written straight to disk, or discarded */
+    if (dirfd != -1) {
+        tree = payload_dirtree(files, dirfd, selected);
+        owner = restore_owner();
+    }
 
-    if (archive_write_open_filename(archive, payload) != ARCHIVE_OK) {
-        warnx("*** archive_write_open_filename: %s", archive_error_string(archive));
-        goto cleanup;
+    if (owner) {
+        payload_owners(files, &uids, &gids);
     }
 
+    pl = pipeline_new(opts->threads, io_buffer_size(pkg, opts->buffer_size), dirfd, tree, true, owner);
+
     /* iterate over every entry in the payload */
     entry = archive_entry_new();
-    buf = xalloc(BUFSIZ);
 
-    while (rc >= 0) {
-        rc = rpmfiNext(fi);
+    /* stop reading once every selected member is written */
+    while (selected == NULL || remaining > 0) {
+        /* keep hashing the compressed payload behind the reader */
+        payload_digest_update(pkg, &pd, payload_position(&src));
+        rc = payload_next(&src);
 
         if (rc == RPMERR_ITER_END) {
             break;
+        } else if (rc < 0) {
+            warnx(_("*** error reading RPM payload (%d)"), rc);
+            ret = -1;
+            break;
         }
 
-        mode = rpmfiFMode(fi);
-        nlink = rpmfiFNlink(fi);
+        fx = rc;
+        mode = rpmfilesFMode(files, fx);
+        nlinks = rpmfilesFLinks(files, fx, &links);
 
-        archive_entry_clear(entry);
-        dn = rpmfiDN(fi);
-
-        if (!strcmp(dn, "")) {
-            dn = "/";
+        /* the rest of a hard link set is written with its content */
+        if (nlinks > 1 && !payload_has_content(&src)) {
+            continue;
         }
 
-        xasprintf(&filename, ".%s%s", dn, rpmfiBN(fi));
-        assert(filename != NULL);
-        archive_entry_copy_pathname(entry, filename);
-        free(filename);
+        /*
+         * If the member with the content of a hard link set is not
+         * selected but another link is, write the content under the
+         * selected name.
+         */
+        target = fx;
+
+        if (selected != NULL && !selected[fx]) {
+            target = (nlinks > 1) ? selected_link(files, selected, fx) : -1;
+
+            if (target == -1) {
+                continue;
+            }
+        }
 
-        archive_entry_set_size(entry, rpmfiFSize(fi));
-        archive_entry_set_filetype(entry, mode & S_IFMT);
-        archive_entry_set_perm(entry, mode);
-        archive_entry_set_uname(entry, rpmfiFUser(fi));
-        archive_entry_set_gname(entry, rpmfiFGroup(fi));
-        archive_entry_set_rdev(entry, rpmfiFRdev(fi));
-        archive_entry_set_mtime(entry, rpmfiFMtime(fi), 0);
+        filename = member_entry(entry, files, target, owner, uids, gids);
+        member = filename + strspn(filename, "/");
 
-        if (S_ISLNK(mode)) {
-            archive_entry_set_symlink(entry, rpmfiFLink(fi));
+        if (opts->verbose && dest != NULL) {
+            printf("x %s/%s\n", dest, member);
         }
 
-        if (nlink > 1) {
-            if (rpmfiArchiveHasContent(fi)) {
-                free(hardlink);
-                hardlink = strdup(archive_entry_pathname(entry));
-                assert(hardlink != NULL);
-            } else {
-                archive_entry_set_hardlink(entry, hardlink);
+        /* the writer checks file content against FILEDIGESTS */
+        check = false;
+
+        if (opts->verify && S_ISREG(mode)) {
+            fdigest = rpmfilesFDigest(files, fx, &algo, &diglen);
+
+            if (fdigest != NULL && diglen > 0 && diglen <= DIGEST_MAX_SIZE) {
+                digest.algo = algo;
+                digest.len = diglen;
+                memcpy(digest.value, fdigest, diglen);
+                check = true;
             }
         }
 
-        archive_write_header(archive, entry);
+        /* hard links stay on one writer so the target exists first */
+        key = (nlinks > 1) ? (long) rpmfilesFInode(files, fx) : -1;
+        pipeline_begin(pl, entry, key, rpmfilesDI(files, target), check ? &digest : NULL);
 
-        if (S_ISREG(mode) && (nlink == 1 || rpmfiArchiveHasContent(fi))) {
-            left = rpmfiFSize(fi);
+        if (S_ISREG(mode) && payload_copy(&src, pl, rpmfilesFSize(files, fx)) == -1) {
+            ret = -1;
+        }
 
-            while (left) {
-                len = (left > BUFSIZ ? BUFSIZ : left);
-                read = rpmfiArchiveRead(fi, buf, len);
+        pipeline_end(pl);
+        remaining -= (selected != NULL);
 
-                if (read == len) {
-                    archive_write_data(archive, buf, len);
-                } else {
-                    warnx(_("*** error reading file from RPM payload"));
-                    break;
-                }
+        /* then the other links of the set */
+        for (i = 0; i < nlinks && ret == 0; i++) {
+            if (links[i] == target || (selected != NULL && !selected[links[i]])) {
+                continue;
+            }
+
+            linkname = member_entry(entry, files, links[i], owner, uids, gids);
+            archive_entry_set_hardlink(entry, member);
 
-                left -= len;
+            if (opts->verbose && dest != NULL) {
+                printf("x %s/%s\n", dest, linkname + strspn(linkname, "/"));
             }
+
+            pipeline_begin(pl, entry, key, rpmfilesDI(files, links[i]), NULL);
+            pipeline_end(pl);
+            remaining -= (selected != NULL);
+            free(linkname);
+        }
+
+        free(filename);
+
+        if (ret == -1) {
+            break;
         }
     }
 
-cleanup:
-    free(hardlink);
-    free(buf);
-    Fclose(gzdi);
+    if (ret == -1) {
+        payload_digest_cancel(&pd);
+    } else if (payload_digest_end(pkg, &pd) == -1) {
+        ret = -1;
+    }
+
+    /* wait for the writers and apply deferred directory metadata */
+    if (pipeline_finish(pl) != 0) {
+        ret = -1;
+    }
+
+    /* named members that are not in the package fail it, like tar(1) */
+    if (missing) {
+        ret = -1;
+    }
+
+    free(selected);
+    free(uids);
+    free(gids);
+    dirtree_free(tree);
+    payload_close(&src);
     archive_entry_free(entry);
-    archive_write_close(archive);
-    archive_write_free(archive);
     rpmfilesFree(files);
-    rpmfiFree(fi);
-    headerFree(hdr);
-    rpmtsFree(ts);
 
-    return payload;
+    if (dirfd != -1) {
+        close(dirfd);
+    }
+
+    return ret;
+}
+
+/*
+ * Write size bytes of the current member's data to the archive,
+ * hashing them in to d unless it is NULL.  Data read in place is
+ * written straight from the mapped package; decompressed data goes
+ * through buf.  Returns 0 on success, -1 on error after reporting it.
+ */
+static int
+convert_copy(struct payload *p, struct archive *a, char *buf, const size_t bufsize, const rpm_loff_t size, struct digest *d)
+{
+    const char *data = NULL;
+    size_t len = 0;
+    rpm_loff_t left = size;
+
+    if (p->fi == NULL && p->size != size) {
+        warnx(_("*** error reading file from RPM payload"));
+        return -1;
+    }
+
+    while (left) {
+        len = (left > bufsize ? bufsize : left);
+
+        if (p->fi == NULL && p->dec == NULL) {
+            data = (const char *) p->pkg->view.data + p->offset + (size - left);
+        } else if (payload_read(p, buf, len) != (ssize_t) len) {
+            warnx(_("*** error reading file from RPM payload"));
+            return -1;
+        } else {
+            data = buf;
+        }
+
+        if (d != NULL) {
+            digest_update(d, data, len);
+        }
+
+        if (archive_write_data(a, data, len) != (la_ssize_t) len) {
+            warnx("*** %s", archive_error_string(a));
+            return -1;
+        }
+
+        left -= len;
+    }
+
+    return 0;
+}
+
+/*
+ * Describe file fx of the package in entry for an archive: owners by
+ * name and resolved id, and no data for anything but a regular file.
+ * In a cpio archive a hard link set is told apart by device, inode,
+ * and link count, nlinks being how many of its links are written.
+ * Returns the file's path, which the caller frees.
+ */
+static char *
+convert_entry(struct archive_entry *entry, rpmfiles files, const int fx, const uid_t *uids, const gid_t *gids, const dev_t dev, const uint32_t nlinks)
+{
+    char *filename = member_entry(entry, files, fx, true, uids, gids);
+
+    archive_entry_copy_uname(entry, rpmfilesFUser(files, fx));
+    archive_entry_copy_gname(entry, rpmfilesFGroup(files, fx));
+
+    if (!S_ISREG(rpmfilesFMode(files, fx))) {
+        archive_entry_set_size(entry, 0);
+    }
+
+    if (dev != 0 && nlinks > 1) {
+        archive_entry_set_dev(entry, dev);
+        archive_entry_set_ino64(entry, rpmfilesFInode(files, fx));
+        archive_entry_set_nlink(entry, nlinks);
+    }
+
+    return filename;
+}
+
+/* Write the header in entry to the archive, naming it when verbose. */
+static int
+convert_header(struct archive *a, struct archive_entry *entry, FILE *vout, const bool verbose)
+{
+    if (verbose) {
+        fprintf(vout, "a %s\n", archive_entry_pathname(entry));
+    }
+
+    if (archive_write_header(a, entry) < ARCHIVE_WARN) {
+        warnx("*** %s: %s", archive_entry_pathname(entry), archive_error_string(a));
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
- * Return an RPM header struct for the given package filename.
+ * Write the payload of an opened RPM package as members of the open
+ * archive a, which may already hold other packages' members.  The
+ * payload is read as it is for extract_rpm_payload(), and opts->filter
+ * and opts->verify apply the same way.  pkgno numbers the package in
+ * the archive.  Returns 0 on success, -1 on error.
  */
-Header
-get_rpm_header(const char *pkg)
+int
+convert_rpm_payload(const struct rpmpkg *pkg, struct archive *a, const unsigned int pkgno, const struct tarpmopts *opts)
 {
-    Header h;
-    rpmts ts;
-    FD_t fd;
-    rpmRC result;
+    int ret = 0;
+    int rc = 0;
+    int fx = 0;
+    int target = 0;
+    int algo = 0;
+    uint32_t i = 0;
+    uint32_t nlinks = 0;
+    uint32_t nwritten = 0;
+    const int *links = NULL;
+    rpmfiles files = NULL;
+    struct payload src;
+    bool cpio = false;
+    dev_t dev = 0;
+    uid_t *uids = NULL;
+    gid_t *gids = NULL;
+    bool *selected = NULL;
+    bool missing = false;
+    size_t remaining = 0;
+    struct paydigest pd;
+    struct filedigest digest;
+    struct digest d;
+    const unsigned char *fdigest = NULL;
+    size_t diglen = 0;
+    bool check = false;
+    struct archive_entry *entry = NULL;
+    rpm_mode_t mode = 0;
+    char *buf = NULL;
+    size_t bufsize = 0;
+    char *filename = NULL;
+    char *linkname = NULL;
+    const char *member = NULL;
+    FILE *vout = stdout;
 
     assert(pkg != NULL);
+    assert(a != NULL);
+    assert(opts != NULL);
 
-    fd = Fopen(pkg, "r.ufdio");
+    memset(&pd, 0, sizeof(pd));
+    files = rpmfilesNew(NULL, pkg->h, 0, RPMFI_KEEPHEADER);
 
-    if (fd == NULL || Ferror(fd)) {
-        warnx(_("Fopen failed for %s: %s"), pkg, Fstrerror(fd));
+    if (opts->verify) {
+        payload_digest_begin(pkg, &pd);
+    }
+
+    if (payload_open(&src, pkg, files, opts->decoders, &pd) == -1) {
+        payload_digest_cancel(&pd);
+        rpmfilesFree(files);
+        return -1;
+    }
+
+    if (opts->filter != NULL) {
+        missing = payload_selection(opts->filter, files, pkg->path, &selected, &remaining);
+    }
+
+    if (opts->archive != NULL && !strcmp(opts->archive, "-")) {
+        vout = stderr;
+    }
+
+    cpio = (archive_format(a) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_CPIO;
+
+    /* cpio links are matched by device, so no two packages share one */
+    dev = cpio ? pkgno + 1 : 0;
+    payload_owners(files, &uids, &gids);
+    bufsize = io_buffer_size(pkg, opts->buffer_size);
+    buf = xalloc(bufsize);
 
-        if (fd) {
-            Fclose(fd);
+    entry = archive_entry_new();
+
+    while (selected == NULL || remaining > 0) {
+        payload_digest_update(pkg, &pd, payload_position(&src));
+        rc = payload_next(&src);
+
+        if (rc == RPMERR_ITER_END) {
+            break;
+        } else if (rc < 0) {
+            warnx(_("*** error reading RPM payload (%d)"), rc);
+            ret = -1;
+            break;
         }
 
-        return NULL;
+        fx = rc;
+        mode = rpmfilesFMode(files, fx);
+        nlinks = rpmfilesFLinks(files, fx, &links);
+
+        /* the rest of a hard link set is written with its content */
+        if (nlinks > 1 && !payload_has_content(&src)) {
+            continue;
+        }
+
+        target = fx;
+
+        if (selected != NULL && !selected[fx]) {
+            target = (nlinks > 1) ? selected_link(files, selected, fx) : -1;
+
+            if (target == -1) {
+                continue;
+            }
+        }
+
+        /* how many links of the set end up in the archive */
+        for (i = 0, nwritten = 0; i < nlinks; i++) {
+            nwritten += (selected == NULL || selected[links[i]]);
+        }
+
+        /* cpio: the other links first, without data */
+        for (i = 0; cpio && i < nlinks && ret == 0; i++) {
+            if (links[i] == target || (selected != NULL && !selected[links[i]])) {
+                continue;
+            }
+
+            linkname = convert_entry(entry, files, links[i], uids, gids, dev, nwritten);
+            archive_entry_set_size(entry, 0);
+            ret = convert_header(a, entry, vout, opts->verbose);
+            remaining -= (selected != NULL);
+            free(linkname);
+        }
+
+        if (ret == -1) {
+            break;
+        }
+
+        filename = convert_entry(entry, files, target, uids, gids, dev, nwritten);
+        member = filename + strspn(filename, "/");
+        check = false;
+
+        if (opts->verify && S_ISREG(mode)) {
+            fdigest = rpmfilesFDigest(files, fx, &algo, &diglen);
+
+            if (fdigest != NULL && diglen > 0 && diglen <= DIGEST_MAX_SIZE) {
+                digest.algo = algo;
+                digest.len = diglen;
+                memcpy(digest.value, fdigest, diglen);
+                digest_init(&d, algo);
+                check = true;
+            }
+        }
+
+        if (convert_header(a, entry, vout, opts->verbose) == -1) {
+            ret = -1;
+        } else if (S_ISREG(mode) && convert_copy(&src, a, buf, bufsize, rpmfilesFSize(files, fx), check ? &d : NULL) == -1) {
+            ret = -1;
+        } else if (check && check_file_digest(member, &d, &digest) == -1) {
+            ret = -1;
+        }
+
+        remaining -= (selected != NULL);
+
+        /* tar: the other links after, pointing at the content */
+        for (i = 0; !cpio && i < nlinks && ret == 0; i++) {
+            if (links[i] == target || (selected != NULL && !selected[links[i]])) {
+                continue;
+            }
+
+            linkname = convert_entry(entry, files, links[i], uids, gids, dev, nwritten);
+            archive_entry_set_size(entry, 0);
+            archive_entry_set_hardlink(entry, member);
+            ret = convert_header(a, entry, vout, opts->verbose);
+            remaining -= (selected != NULL);
+            free(linkname);
+        }
+
+        free(filename);
+
+        if (ret == -1) {
+            break;
+        }
     }
 
-    ts = rpmtsCreate();
-    rpmtsSetVSFlags(ts, _RPMVSF_NODIGESTS | _RPMVSF_NOSIGNATURES);
-    result = rpmReadPackageFile(ts, fd, pkg, &h);
-    rpmtsFree(ts);
-    Fclose(fd);
+    if (ret == -1) {
+        payload_digest_cancel(&pd);
+    } else if (payload_digest_end(pkg, &pd) == -1) {
+        ret = -1;
+    }
 
-    if (result != RPMRC_OK) {
-        return NULL;
+    if (missing) {
+        ret = -1;
     }
 
-    return h;
+    free(buf);
+    free(selected);
+    free(uids);
+    free(gids);
+    payload_close(&src);
+    archive_entry_free(entry);
+    rpmfilesFree(files);
+
+    return ret;
 }
 
 /*
@@ -0,0 +1,251 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * SHA-256 (FIPS 180-4) for payload verification.  On x86 processors
+ * with the SHA extensions the compression function uses the
+ * SHA256RNDS2/SHA256MSG1/SHA256MSG2 instructions; everything else uses
+ * the portable implementation.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
+#include "tarpm.h"
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+blocks_scalar(uint32_t state[8], const uint8_t *data, size_t n)
+{
+    unsigned int i = 0;
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+
+    while (n--) {
+        for (i = 0; i < 16; i++) {
+            w[i] = ((uint32_t) data[4 * i] << 24) | ((uint32_t) data[4 * i + 1] << 16)
+                   | ((uint32_t) data[4 * i + 2] << 8) | data[4 * i + 3];
+        }
+
+        for (i = 16; i < 64; i++) {
+            w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3))
+                   + w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+        }
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+
+        for (i = 0; i < 64; i++) {
+            t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += SHA256_BLOCK_SIZE;
+    }
+
+    return;
+}
+
+#ifdef SHA256_X86
+/*
+ * Each pass does four rounds with two SHA256RNDS2 instructions while
+ * the message schedule for later rounds is computed in w[].
+ */
+__attribute__((target("sha,sse4.1")))
+static void
+blocks_shani(uint32_t state[8], const uint8_t *data, size_t n)
+{
+    unsigned int i = 0;
+    __m128i state0, state1, msg, tmp, abef, cdgh;
+    __m128i w[4];
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* the instructions want the state as ABEF and CDGH */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xb1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1b);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    while (n--) {
+        abef = state0;
+        cdgh = state1;
+
+#pragma GCC unroll 16
+        for (i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + (16 * i))), mask);
+            }
+
+            msg = _mm_add_epi32(w[i % 4], _mm_loadu_si128((const __m128i *) &K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+            if (i >= 3 && i <= 14) {
+                tmp = _mm_alignr_epi8(w[i % 4], w[(i + 3) % 4], 4);
+                w[(i + 1) % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(w[(i + 1) % 4], tmp), w[i % 4]);
+            }
+
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+            if (i >= 1 && i <= 12) {
+                w[(i + 3) % 4] = _mm_sha256msg1_epu32(w[(i + 3) % 4], w[i % 4]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += SHA256_BLOCK_SIZE;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    _mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(tmp, state1, 0xf0));
+    _mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(state1, tmp, 8));
+    return;
+}
+#endif
+
+static void
+blocks(uint32_t state[8], const uint8_t *data, const size_t n)
+{
+#ifdef SHA256_X86
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        blocks_shani(state, data, n);
+        return;
+    }
+#endif
+
+    blocks_scalar(state, data, n);
+    return;
+}
+
+void
+sha256_init(struct sha256 *ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    assert(ctx != NULL);
+
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->len = 0;
+    ctx->n = 0;
+    return;
+}
+
+void
+sha256_update(struct sha256 *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t take = 0;
+
+    assert(ctx != NULL);
+    assert(data != NULL || len == 0);
+
+    ctx->len += len;
+
+    /* finish a partial block first */
+    if (ctx->n > 0) {
+        take = SHA256_BLOCK_SIZE - ctx->n;
+        take = (len < take) ? len : take;
+        memcpy(ctx->buf + ctx->n, p, take);
+        ctx->n += take;
+        p += take;
+        len -= take;
+
+        if (ctx->n < SHA256_BLOCK_SIZE) {
+            return;
+        }
+
+        blocks(ctx->h, ctx->buf, 1);
+        ctx->n = 0;
+    }
+
+    /* whole blocks straight from the caller's buffer */
+    if (len >= SHA256_BLOCK_SIZE) {
+        blocks(ctx->h, p, len / SHA256_BLOCK_SIZE);
+        p += len - (len % SHA256_BLOCK_SIZE);
+        len %= SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buf, p, len);
+    ctx->n = len;
+    return;
+}
+
+/* Finish the hash and store the digest in out. */
+void
+sha256_final(struct sha256 *ctx, uint8_t out[SHA256_DIGEST_SIZE])
+{
+    unsigned int i = 0;
+    uint64_t bits = 0;
+
+    assert(ctx != NULL);
+    assert(out != NULL);
+
+    bits = htobe64(ctx->len * 8);
+    ctx->buf[ctx->n++] = 0x80;
+
+    if (ctx->n > SHA256_BLOCK_SIZE - sizeof(bits)) {
+        memset(ctx->buf + ctx->n, 0, SHA256_BLOCK_SIZE - ctx->n);
+        blocks(ctx->h, ctx->buf, 1);
+        ctx->n = 0;
+    }
+
+    memset(ctx->buf + ctx->n, 0, SHA256_BLOCK_SIZE - sizeof(bits) - ctx->n);
+    memcpy(ctx->buf + SHA256_BLOCK_SIZE - sizeof(bits), &bits, sizeof(bits));
+    blocks(ctx->h, ctx->buf, 1);
+
+    for (i = 0; i < 8; i++) {
+        out[4 * i] = ctx->h[i] >> 24;
+        out[4 * i + 1] = ctx->h[i] >> 16;
+        out[4 * i + 2] = ctx->h[i] >> 8;
+        out[4 * i + 3] = ctx->h[i];
+    }
+
+    return;
+}
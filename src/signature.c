@@ -11,68 +11,47 @@
 
 /*
  * Extract the data of the RPM signature and convert it to JSON data.
+ * Temporaries come from arena, which is reset before returning.
  * Returns 0 on success, -1 on error.
  */
 int
-extract_signature(const int fd, const char *output_dir)
+extract_signature(const struct rpmpkg *pkg, const char *output_dir, const struct tarpmopts *opts, struct arena *arena)
 {
-    uint32_t *buffer = NULL;
-    struct rpmsignature *sig = NULL;
-    struct rpmsigvalues *svals = NULL;
-    struct rpmidxentry *entry = NULL;
-    struct rpmidxentry *trailer = NULL;
-    struct json_object *out = NULL;
-    struct json_object *jvals = NULL;
+    const struct rpmsection *section = NULL;
+    const struct rpmidxentry *entry = NULL;
+    struct jsonw *w = NULL;
+    int ret = 0;
 
-    assert(fd > 0);
+    assert(pkg != NULL);
     assert(output_dir != NULL);
+    assert(opts != NULL);
+    assert(arena != NULL);
 
-    /* read in the signature */
-    sig = read_header_signature(fd);
+    /* read once when the package was opened */
+    section = &pkg->signature;
 
-    if (sig == NULL) {
-        err(EXIT_FAILURE, "read_header_signature");
-    }
-
-    /* computed from header values */
-    svals = compute_sigvalues(sig, true);
+    /* first entry */
+    entry = section->svals.estart;
 
-    /* read in the entries */
-    buffer = read_header_entries(fd, sig, svals->hlen);
-    svals->estart = (struct rpmidxentry *) &(buffer[2]);
-    svals->datastart = (uint8_t *) (svals->estart + sig->nentries);
+    /* write the signature to a file as it is decoded */
+    w = json_open(arena, output_dir, OUTPUT_SIGNATURE, !opts->compact_json);
 
-    /* signature is aligned, so padding may be present */
-    if (read(fd, &svals->pad, svals->padlen) != svals->padlen) {
-        err(EXIT_FAILURE, "read");
+    if (w == NULL) {
+        arena_reset(arena);
+        return -1;
     }
 
-    /* first entry */
-    entry = (struct rpmidxentry *) (buffer + 2);
-
-    /* handle trailer */
-    /* the trailer is not guaranteed to be aligned, copy required */
-    trailer = read_header_trailer(entry, svals->datastart);
-
-    /* generate a JSON structure for the signature */
-    out = generate_json(sig, svals);
+    json_begin_object(w, NULL);
+    generate_json(w, &section->sig, &section->svals);
 
     /* dump all of the tags in the signature */
-    jvals = generate_json_entries(sig, svals, entry, true);
+    generate_json_entries(w, &section->sig, &section->svals, entry, true);
+    json_end_object(w);
 
-    /* write the signature to a file */
-    json_object_object_add(out, RPM_ENTRY_TAGS_DESC, json_object_get(jvals));
-
-    if (write_json_file(out, output_dir, OUTPUT_SIGNATURE) != 0) {
-        warn("write_json_file");
-    }
+    ret = json_close(w);
 
-    /* cleanup */
-    free_json(out);
-    json_object_put(jvals);
-    free(trailer);
-    free(buffer);
-    free(sig);
+    /* cleanup, everything above came from the arena */
+    arena_reset(arena);
 
-    return 0;
+    return ret;
 }
@@ -15,202 +15,824 @@
  * limitations under the License.
  */
 
-#include <string.h>
+/*
+ * Payload disk writer.  Members are written relative to an open
+ * destination directory with the *at() family of system calls, so
+ * nothing depends on the current working directory or the umask and
+ * any number of writers may run at once in one process.
+ *
+ * Member paths must be relative and may not contain ".." components.
+ * Missing parent directories are created as needed and symbolic links
+ * are never followed on the way to a member.  When the directories of
+ * the payload are known up front, a directory tree built by
+ * dirtree_new() creates them all in one pass and members are then
+ * created straight from a cached parent descriptor.
+ *
+ * Directory permissions and times are deferred until every writer
+ * sharing the destination has finished (see disk_writers_close()), so
+ * restrictive modes do not get in the way and creating files does not
+ * disturb the times.  Ownership is restored only by writers created
+ * with owner set; the setuid and setgid bits are kept only then.
+ */
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
-#include <unistd.h>
 #include <stdbool.h>
-#include <string.h>
+#include <stdint.h>
 #include <limits.h>
 #include <errno.h>
 #include <err.h>
-#include <archive.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <archive_entry.h>
 
 #include "tarpm.h"
 
-/* Local prototypes */
-static int copy_data(struct archive *, struct archive *);
-static int extract_entry(struct archive *, struct archive *, struct archive_entry *);
+/*
+ * Payload directories created ahead of the members.  The descriptors
+ * of the busiest directories are kept open, by directory index, and
+ * are shared read-only by every writer.
+ */
+struct dirtree {
+    int *fds;                      /* -1 if not kept open */
+    size_t ndirs;
+};
+
+/* A directory of the tree, for sorting. */
+struct dirorder {
+    const char *name;
+    uint32_t nfiles;
+    size_t dx;
+};
+
+/* One open directory on the path being walked by dirtree_new(). */
+struct dirlevel {
+    const char *name;
+    size_t len;
+    int fd;
+};
+
+/* Directory metadata applied once all members are written. */
+struct dirfixup {
+    char *path;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    struct timespec mtime;
+};
+
+struct diskw {
+    int dirfd;                     /* destination, owned by the caller */
+    const struct dirtree *tree;    /* may be NULL */
+    bool force;
+    bool owner;                    /* restore ownership */
+    int fd;                        /* regular file being written */
+    char *path;                    /* member being written */
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    struct timespec mtime;
+    char *parent;                  /* last parent directory opened */
+    int parentfd;
+    struct dirfixup *fixups;
+    size_t nfixups;
+    size_t fixupsize;
+};
+
+/* Permission bits that are restored on members, and with ownership. */
+#define DISK_PERM_MASK  (S_IRWXU | S_IRWXG | S_IRWXO | S_ISVTX)
+#define DISK_OWNER_MASK (DISK_PERM_MASK | S_ISUID | S_ISGID)
 
 /*
- * From:
- * https://github.com/libarchive/libarchive/wiki/Examples
- * Reads data from the input archive stream and writes it to the output
- * archive stream.
+ * Check that a member path stays below the destination.  Returns true
+ * if the path is relative and has no ".." components.
  */
-static int
-copy_data(struct archive *ar, struct archive *aw)
+static bool
+safe_path(const char *path)
 {
-    int r;
-    const void *buf = NULL;
-    size_t s;
-    off_t o;
+    const char *p = path;
+    size_t len = 0;
 
-    while ((r = archive_read_data_block(ar, &buf, &s, &o)) != ARCHIVE_EOF) {
-        if (r != ARCHIVE_OK) {
-            return r;
-        }
+    if (*path == '\0' || *path == '/') {
+        return false;
+    }
 
-        r = archive_write_data_block(aw, buf, s, o);
+    while (*p != '\0') {
+        len = strcspn(p, "/");
 
-        if (r != ARCHIVE_OK) {
-            warnx("archive_write_data_block: %s", archive_error_string(aw));
-            return r;
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            return false;
         }
+
+        p += len;
+        p += strspn(p, "/");
     }
 
-    return ARCHIVE_OK;
+    return true;
 }
 
-/* Extract a single entry from an archive and write it to disk. */
+/*
+ * Open the directory named by the first len bytes of path below
+ * dirfd, one component at a time without following symbolic links.
+ * Missing components are created if create is true.  Returns the new
+ * descriptor, or -1 on error after reporting it.
+ */
 static int
-extract_entry(struct archive *input, struct archive *output, struct archive_entry *entry)
+open_dirs(const int dirfd, const char *path, const size_t len, const bool create)
 {
-    int r = 0;
-    int ret = 0;
+    int fd = dirfd;
+    int next = -1;
+    char *copy = NULL;
+    char *component = NULL;
+    char *save = NULL;
+
+    copy = strndup(path, len);
+    assert(copy != NULL);
+
+    for (component = strtok_r(copy, "/", &save); component != NULL; component = strtok_r(NULL, "/", &save)) {
+        if (!strcmp(component, ".")) {
+            continue;
+        }
 
-    r = archive_write_header(output, entry);
+        next = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 
-    if (r != ARCHIVE_OK) {
-        warnx("archive_write_header: %s", archive_error_string(output));
-        ret = -1;
-    } else if (archive_entry_size(entry) > 0) {
-        if (copy_data(input, output) != ARCHIVE_OK) {
-            ret = -1;
+        if (next == -1 && errno == ENOENT && create) {
+            /* another writer may create it first */
+            if (mkdirat(fd, component, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 && errno != EEXIST) {
+                warn(_("*** unable to mkdir %.*s"), (int) len, path);
+                break;
+            }
+
+            next = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
         }
 
-        if (r != ARCHIVE_OK) {
-            warnx("archive_write_header: %s", archive_error_string(output));
-        } else if (r < ARCHIVE_WARN) {
-            ret = -1;
+        if (next == -1) {
+            warn(_("*** unable to open directory %.*s"), (int) len, path);
+            break;
+        }
+
+        if (fd != dirfd) {
+            close(fd);
         }
+
+        fd = next;
     }
 
-    r = archive_write_finish_entry(output);
+    if (component != NULL && fd != dirfd) {
+        close(fd);
+    }
 
-    if (r != ARCHIVE_OK) {
-        warnx("archive_write_finish_entry: %s", archive_error_string(output));
-    } else if (r < ARCHIVE_WARN) {
-        ret = -1;
+    free(copy);
+
+    if (component != NULL) {
+        return -1;
     }
 
-    return ret;
+    return (fd == dirfd) ? dup(dirfd) : fd;
+}
+
+/* Busiest directories first. */
+static int
+count_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((const struct dirorder *) a)->nfiles;
+    uint32_t y = ((const struct dirorder *) b)->nfiles;
+
+    return (x < y) - (x > y);
+}
+
+static int
+name_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct dirorder *) a)->name, ((const struct dirorder *) b)->name);
 }
 
 /*
- * Unpack an archive file to a destination directory.  The directory must
- * exist before calling this function.
+ * Create the ndirs directories named in dirnames below dirfd, such as
+ * those listed in a package's DIRNAMES, before any member is written.
+ * The names are visited in sorted order while the chain of open
+ * parents is kept, so each directory costs one mkdirat() and one
+ * openat() no matter how deep it is.  nfiles holds the number of
+ * members in each directory; the descriptors of the DIRTREE_CACHE_SIZE
+ * busiest directories are kept for disk writers to create members
+ * from.  NULL names are skipped, so a subset of the directories can
+ * be created while the indexes still match DIRINDEXES.  Directories
+ * that cannot be created here are left for the writers to report.
+ * dirfd must stay open while the tree is in use.
  */
-int
-unpack_archive(const char *archive, const char *dest, const bool force, const bool verbose)
+struct dirtree *
+dirtree_new(const int dirfd, const char *const *dirnames, const size_t ndirs, const uint32_t *nfiles)
 {
-    int flags, r, ret = 0;
-    char *rfilename = NULL;
-    char cwd[PATH_MAX + 1];
+    size_t i = 0;
+    size_t n = 0;
+    size_t dx = 0;
+    size_t depth = 0;
+    size_t level = 0;
+    size_t len = 0;
+    size_t maxdepth = 0;
+    int fd = -1;
+    char component[NAME_MAX + 1];
+    struct dirorder *order = NULL;
+    bool *keep = NULL;
+    bool ok = true;
     const char *p = NULL;
-    struct archive *input = NULL;
-    struct archive *output = NULL;
-    struct archive_entry *entry = NULL;
+    struct dirlevel *stack = NULL;
+    struct dirtree *tree = NULL;
+
+    assert(dirfd >= 0);
+    assert(dirnames != NULL || ndirs == 0);
+    assert(nfiles != NULL || ndirs == 0);
 
-    assert(archive != NULL);
-    assert(dest != NULL);
-    memset(cwd, '\0', sizeof(cwd));
+    tree = xalloc(sizeof(*tree));
+    tree->ndirs = ndirs;
+    tree->fds = xcalloc(ndirs ? ndirs : 1, sizeof(*tree->fds));
+    order = xcalloc(ndirs ? ndirs : 1, sizeof(*order));
+    keep = xcalloc(ndirs ? ndirs : 1, sizeof(*keep));
 
-    /* attributes to restore */
-    flags = ARCHIVE_EXTRACT_TIME;
-    flags |= ARCHIVE_EXTRACT_PERM;
-    flags |= ARCHIVE_EXTRACT_ACL;
-    flags |= ARCHIVE_EXTRACT_FFLAGS;
+    for (i = 0; i < ndirs; i++) {
+        tree->fds[i] = -1;
 
-    if (force) {
-        /* user passed a -f flag, so try to force past errors unpacking */
-        flags |= ARCHIVE_EXTRACT_UNLINK;
+        if (dirnames[i] == NULL) {
+            continue;
+        }
+
+        order[n].name = dirnames[i];
+        order[n].nfiles = nfiles[i];
+        order[n].dx = i;
+        n++;
+
+        /* a name of n bytes has at most n / 2 + 1 components */
+        len = strlen(dirnames[i]) / 2 + 1;
+        maxdepth = (len > maxdepth) ? len : maxdepth;
     }
 
-    /* full location to the archive */
-    if ((rfilename = realpath(archive, rfilename)) == NULL) {
-        if (errno == ENOENT) {
-            return 0;
-        } else {
-            warn("realpath: %s", archive);
-            return -1;
+    qsort(order, n, sizeof(*order), count_cmp);
+
+    for (i = 0; i < n && i < DIRTREE_CACHE_SIZE; i++) {
+        keep[order[i].dx] = true;
+    }
+
+    qsort(order, n, sizeof(*order), name_cmp);
+
+    stack = xcalloc(maxdepth + 1, sizeof(*stack));
+    stack[0].fd = dirfd;
+
+    for (i = 0; i < n; i++) {
+        dx = order[i].dx;
+        p = order[i].name + strspn(order[i].name, "/");
+        depth = 0;
+        ok = true;
+
+        if (*p != '\0' && !safe_path(p)) {
+            continue;
+        }
+
+        while (*(p += strspn(p, "/")) != '\0') {
+            len = strcspn(p, "/");
+
+            if (len == 1 && *p == '.') {
+                p += len;
+                continue;
+            }
+
+            if (len > NAME_MAX) {
+                ok = false;
+                break;
+            }
+
+            depth++;
+
+            /* still on the path of the previous directory */
+            if (depth <= level && stack[depth].len == len && !memcmp(stack[depth].name, p, len)) {
+                p += len;
+                continue;
+            }
+
+            /* leave the previous path where this one turns off */
+            while (level >= depth) {
+                close(stack[level--].fd);
+            }
+
+            memcpy(component, p, len);
+            component[len] = '\0';
+            fd = -1;
+
+            if (mkdirat(stack[level].fd, component, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0 || errno == EEXIST) {
+                fd = openat(stack[level].fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+
+            if (fd == -1) {
+                ok = false;
+                break;
+            }
+
+            stack[depth].name = p;
+            stack[depth].len = len;
+            stack[depth].fd = fd;
+            level = depth;
+            p += len;
         }
+
+        if (ok && keep[dx]) {
+            tree->fds[dx] = dup(stack[depth].fd);
+        }
+    }
+
+    while (level > 0) {
+        close(stack[level--].fd);
+    }
+
+    free(stack);
+    free(keep);
+    free(order);
+
+    return tree;
+}
+
+/*
+ * Return the cached descriptor of directory dx, or -1 if there is
+ * none.  The descriptor belongs to the tree.
+ */
+static int
+dirtree_fd(const struct dirtree *tree, const long dx)
+{
+    if (tree == NULL || dx < 0 || (size_t) dx >= tree->ndirs) {
+        return -1;
+    }
+
+    return tree->fds[dx];
+}
+
+void
+dirtree_free(struct dirtree *tree)
+{
+    size_t i = 0;
+
+    if (tree == NULL) {
+        return;
+    }
+
+    for (i = 0; i < tree->ndirs; i++) {
+        if (tree->fds[i] != -1) {
+            close(tree->fds[i]);
+        }
+    }
+
+    free(tree->fds);
+    free(tree);
+    return;
+}
+
+/*
+ * Return a descriptor for the directory holding the member at path,
+ * which is directory dx of the tree (or -1 if unknown), and point
+ * base at the last component.  Directories missing from the tree are
+ * walked to; members arrive in path order, so the last one walked to
+ * is kept open for the next member.  The descriptor belongs to the
+ * writer or the tree.  Returns -1 on error.
+ */
+static int
+open_parent(struct diskw *d, const char *path, const long dx, const char **base)
+{
+    const char *slash = strrchr(path, '/');
+    size_t len = 0;
+    int fd = dirtree_fd(d->tree, dx);
+
+    if (slash == NULL) {
+        *base = path;
+        return d->dirfd;
+    }
+
+    *base = slash + 1;
+    len = slash - path;
+
+    if (fd != -1) {
+        return fd;
+    }
+
+    if (d->parent != NULL && strlen(d->parent) == len && !strncmp(d->parent, path, len)) {
+        return d->parentfd;
+    }
+
+    if (d->parent != NULL) {
+        close(d->parentfd);
+        free(d->parent);
+        d->parent = NULL;
+    }
+
+    d->parentfd = open_dirs(d->dirfd, path, len, true);
+
+    if (d->parentfd == -1) {
+        return -1;
+    }
+
+    d->parent = strndup(path, len);
+    assert(d->parent != NULL);
+    return d->parentfd;
+}
+
+/*
+ * Clear the way for a new member named base in the directory pfd.  An
+ * existing directory is kept if a directory is wanted.  Anything else
+ * in the way is removed if the writer was created with force, and is
+ * an error otherwise.  Returns 0 if the name is free (or is a wanted
+ * directory), -1 on error.
+ */
+static int
+make_room(const struct diskw *d, const int pfd, const char *base, const bool dir)
+{
+    struct stat sb;
+
+    if (fstatat(pfd, base, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+
+    if (S_ISDIR(sb.st_mode) && dir) {
+        return 0;
+    }
+
+    if (!d->force) {
+        errno = EEXIST;
+        return -1;
     }
 
-    /* archive reader */
-    input = archive_read_new();
-#if ARCHIVE_VERSION_NUMBER < 3000000
-    archive_read_support_compression_all(input);
-#else
-    archive_read_support_filter_all(input);
-#endif
-    archive_read_support_format_all(input);
-    r = archive_read_open_filename(input, archive, BUFSIZ);
+    return unlinkat(pfd, base, S_ISDIR(sb.st_mode) ? AT_REMOVEDIR : 0);
+}
+
+static void
+add_fixup(struct diskw *d, const char *path)
+{
+    if (d->nfixups == d->fixupsize) {
+        d->fixupsize = d->fixupsize ? d->fixupsize * 2 : 64;
+        d->fixups = xrealloc(d->fixups, d->fixupsize * sizeof(*d->fixups));
+    }
 
-    if (r != ARCHIVE_OK) {
-        archive_read_free(input);
+    d->fixups[d->nfixups].path = strdup(path);
+    assert(d->fixups[d->nfixups].path != NULL);
+    d->fixups[d->nfixups].mode = d->mode;
+    d->fixups[d->nfixups].uid = d->uid;
+    d->fixups[d->nfixups].gid = d->gid;
+    d->fixups[d->nfixups].mtime = d->mtime;
+    d->nfixups++;
+    return;
+}
+
+/*
+ * Create a disk writer for the destination directory dirfd, whose
+ * directories may already have been created as tree (or NULL).  If
+ * force is true, existing files in the way of members are removed
+ * first.  If owner is true, members are given the uid and gid of
+ * their entries.  The caller keeps ownership of dirfd and the tree
+ * and must keep them until the writer is closed.
+ */
+struct diskw *
+disk_writer_new(const int dirfd, const struct dirtree *tree, const bool force, const bool owner)
+{
+    struct diskw *d = NULL;
+
+    assert(dirfd >= 0);
+
+    d = xcalloc(1, sizeof(*d));
+    d->dirfd = dirfd;
+    d->tree = tree;
+    d->force = force;
+    d->owner = owner;
+    d->fd = -1;
+    d->parentfd = -1;
+
+    return d;
+}
+
+/*
+ * Begin writing the member described by entry, whose parent is
+ * directory dx of the writer's tree or -1 if unknown.  Regular files
+ * are left open for disk_write_data(); everything else is complete
+ * once this returns.  Returns 0 on success, -1 on error after
+ * reporting it.
+ */
+int
+disk_write_header(struct diskw *d, struct archive_entry *entry, const long dx)
+{
+    int pfd = -1;
+    const char *path = NULL;
+    const char *base = NULL;
+    const char *target = NULL;
+    mode_t type = 0;
+    struct timespec times[2];
+
+    assert(d != NULL);
+    assert(entry != NULL);
+    assert(d->fd == -1);
+
+    path = archive_entry_pathname(entry);
+
+    if (path == NULL || !safe_path(path)) {
+        warnx(_("*** refusing to extract %s outside the destination"), path ? path : "(null)");
         return -1;
     }
 
-    /* change to dest */
-    if (getcwd(cwd, PATH_MAX) == NULL) {
-        archive_read_free(input);
-        err(EXIT_FAILURE, "getcwd");
+    pfd = open_parent(d, path, dx, &base);
+
+    if (pfd == -1) {
+        return -1;
     }
 
-    if (chdir(dest) != 0) {
-        warn("chdir");
-        archive_read_free(input);
+    type = archive_entry_filetype(entry);
+    d->mode = archive_entry_perm(entry) & (d->owner ? DISK_OWNER_MASK : DISK_PERM_MASK);
+    d->uid = archive_entry_uid(entry);
+    d->gid = archive_entry_gid(entry);
+    d->mtime.tv_sec = archive_entry_mtime(entry);
+    d->mtime.tv_nsec = archive_entry_mtime_nsec(entry);
+
+    /* the access time is when the member was extracted */
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_NOW;
+    times[1] = d->mtime;
+
+    if (make_room(d, pfd, base, type == AE_IFDIR) == -1) {
+        warn(_("*** unable to replace %s"), path);
         return -1;
     }
 
-    /* handler to write archive members to disk */
-    output = archive_write_disk_new();
-    archive_write_disk_set_options(output, flags);
-    archive_write_disk_set_standard_lookup(output);
+    switch (type) {
+        case AE_IFDIR:
+            if (mkdirat(pfd, base, S_IRWXU) == -1 && errno != EEXIST) {
+                warn(_("*** unable to mkdir %s"), path);
+                return -1;
+            }
+
+            add_fixup(d, path);
+            return 0;
+        case AE_IFREG:
+            target = archive_entry_hardlink(entry);
+
+            if (target != NULL) {
+                if (!safe_path(target)) {
+                    warnx(_("*** refusing to link %s to %s outside the destination"), path, target);
+                    return -1;
+                }
+
+                if (linkat(d->dirfd, target, pfd, base, 0) == -1) {
+                    warn(_("*** unable to link %s to %s"), path, target);
+                    return -1;
+                }
+
+                return 0;
+            }
+
+            d->fd = openat(pfd, base, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+            if (d->fd == -1) {
+                warn(_("*** unable to create %s"), path);
+                return -1;
+            }
+
+            d->path = strdup(path);
+            assert(d->path != NULL);
+            return 0;
+        case AE_IFLNK:
+            if (symlinkat(archive_entry_symlink(entry), pfd, base) == -1) {
+                warn(_("*** unable to create symlink %s"), path);
+                return -1;
+            }
+
+            if (d->owner && fchownat(pfd, base, d->uid, d->gid, AT_SYMLINK_NOFOLLOW) == -1) {
+                warn(_("*** unable to set owner of %s"), path);
+                return -1;
+            }
 
-    /* extract each archive member */
-    while ((r = archive_read_next_header(input, &entry)) != ARCHIVE_EOF) {
-        if (r == ARCHIVE_FATAL) {
-            /* we cannot recover here, so just take what we could extract */
             break;
-        }
+        case AE_IFCHR:
+        case AE_IFBLK:
+        case AE_IFIFO:
+            if (mknodat(pfd, base, type | d->mode, archive_entry_rdev(entry)) == -1) {
+                warn(_("*** unable to create %s"), path);
+                return -1;
+            }
 
-        if (r != ARCHIVE_OK) {
-            warnx("archive_read_next_header: %s", archive_error_string(input));
-        } else if (r < ARCHIVE_WARN) {
-            ret = -1;
+            /* chown clears the setuid and setgid bits, so it goes first */
+            if ((d->owner && fchownat(pfd, base, d->uid, d->gid, AT_SYMLINK_NOFOLLOW) == -1)
+                || fchmodat(pfd, base, d->mode, 0) == -1) {
+                warn(_("*** unable to set attributes on %s"), path);
+                return -1;
+            }
+
+            break;
+        default:
+            warnx(_("*** %s has an unsupported file type"), path);
+            return -1;
+    }
+
+    if (utimensat(pfd, base, times, AT_SYMLINK_NOFOLLOW) == -1) {
+        warn(_("*** unable to set times on %s"), path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Append len bytes of data to the regular file being written.
+ * Returns 0 on success, -1 on error after reporting it.
+ */
+int
+disk_write_data(struct diskw *d, const char *buf, const size_t len)
+{
+    size_t done = 0;
+    ssize_t r = 0;
+
+    assert(d != NULL);
+    assert(buf != NULL || len == 0);
+
+    if (d->fd == -1) {
+        return (len == 0) ? 0 : -1;
+    }
+
+    while (done < len) {
+        r = write(d->fd, buf + done, len - done);
+
+        if (r == -1 && errno == EINTR) {
+            continue;
+        } else if (r == -1) {
+            warn(_("*** unable to write %s"), d->path);
+            return -1;
         }
 
-        if (verbose) {
-            p = archive_entry_pathname(entry);
+        done += r;
+    }
+
+    return 0;
+}
+
+/*
+ * Append len bytes of srcfd, starting at offset, to the regular file
+ * being written.  The data moves inside the kernel and is never copied
+ * through user space: copy_file_range() is tried first and sendfile()
+ * is used where the two files cannot be copied between that way, such
+ * as across file systems on older kernels.  Returns 0 on success, -1
+ * on error after reporting it.
+ */
+int
+disk_write_range(struct diskw *d, const int srcfd, off_t offset, const size_t len)
+{
+    size_t done = 0;
+    ssize_t r = 0;
+    bool fallback = false;
+
+    assert(d != NULL);
+    assert(srcfd >= 0);
 
-            while ((*p == '.' || *p == '/') && *p != '\0') {
-                p++;
+    if (d->fd == -1) {
+        return (len == 0) ? 0 : -1;
+    }
+
+    while (done < len) {
+        if (!fallback) {
+            r = copy_file_range(srcfd, &offset, d->fd, NULL, len - done, 0);
+
+            if (r == -1 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                fallback = true;
+                continue;
             }
+        } else {
+            r = sendfile(d->fd, srcfd, &offset, len - done);
+        }
 
-            printf("x %s/%s\n", dest, p);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        } else if (r == -1) {
+            warn(_("*** unable to write %s"), d->path);
+            return -1;
+        } else if (r == 0) {
+            warnx(_("*** unable to write %s: unexpected end of package"), d->path);
+            return -1;
         }
 
-        if (extract_entry(input, output, entry)) {
+        done += r;
+    }
+
+    return 0;
+}
+
+/*
+ * Finish the current member, setting the owner, mode, and times of a
+ * regular file and closing it.  Returns 0 on success, -1 on error.
+ */
+int
+disk_write_finish(struct diskw *d)
+{
+    int ret = 0;
+    struct timespec times[2];
+
+    assert(d != NULL);
+
+    if (d->fd == -1) {
+        return 0;
+    }
+
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_NOW;
+    times[1] = d->mtime;
+
+    if ((d->owner && fchown(d->fd, d->uid, d->gid) == -1)
+        || fchmod(d->fd, d->mode) == -1 || futimens(d->fd, times) == -1) {
+        warn(_("*** unable to set attributes on %s"), d->path);
+        ret = -1;
+    }
+
+    if (close(d->fd) == -1) {
+        warn(_("*** unable to write %s"), d->path);
+        ret = -1;
+    }
+
+    d->fd = -1;
+    free(d->path);
+    d->path = NULL;
+
+    return ret;
+}
+
+/* Deepest directories first, so a parent is never fixed before a child. */
+static int
+fixup_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct dirfixup *) b)->path, ((const struct dirfixup *) a)->path);
+}
+
+/*
+ * Close n disk writers that share a destination.  Their deferred
+ * directory metadata is applied together once all of them are idle.
+ * Returns 0 on success, -1 if any directory could not be fixed up.
+ */
+int
+disk_writers_close(struct diskw **writers, const unsigned int n)
+{
+    int ret = 0;
+    int fd = -1;
+    unsigned int i = 0;
+    size_t j = 0;
+    size_t total = 0;
+    struct dirfixup *all = NULL;
+    struct diskw *d = NULL;
+    struct timespec times[2];
+
+    assert(writers != NULL || n == 0);
+
+    for (i = 0; i < n; i++) {
+        assert(writers[i]->fd == -1);
+        total += writers[i]->nfixups;
+    }
+
+    all = xcalloc(total ? total : 1, sizeof(*all));
+
+    for (i = 0, total = 0; i < n; i++) {
+        if (writers[i]->nfixups > 0) {
+            memcpy(all + total, writers[i]->fixups, writers[i]->nfixups * sizeof(*all));
+            total += writers[i]->nfixups;
+        }
+    }
+
+    qsort(all, total, sizeof(*all), fixup_cmp);
+
+    for (j = 0; j < total; j++) {
+        fd = open_dirs(writers[0]->dirfd, all[j].path, strlen(all[j].path), false);
+
+        if (fd == -1) {
             ret = -1;
+        } else {
+            times[0].tv_sec = 0;
+            times[0].tv_nsec = UTIME_NOW;
+            times[1] = all[j].mtime;
+
+            if ((writers[0]->owner && fchown(fd, all[j].uid, all[j].gid) == -1)
+                || fchmod(fd, all[j].mode) == -1 || futimens(fd, times) == -1) {
+                warn(_("*** unable to set attributes on %s"), all[j].path);
+                ret = -1;
+            }
+
+            close(fd);
         }
+
+        free(all[j].path);
     }
 
-    archive_read_free(input);
-#if ARCHIVE_VERSION_NUMBER < 3000000
-    archive_write_finish(output);
-#else
-    archive_write_free(output);
-#endif
+    free(all);
 
-    /* change back to original directory */
-    if (chdir(cwd) != 0) {
-        warn("chdir");
-        return -1;
+    for (i = 0; i < n; i++) {
+        d = writers[i];
+
+        if (d->parent != NULL) {
+            close(d->parentfd);
+            free(d->parent);
+        }
+
+        free(d->fixups);
+        free(d);
     }
 
-    free(rfilename);
     return ret;
 }
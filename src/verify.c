@@ -0,0 +1,474 @@
+/*
+ * Copyright The tarpm Project Authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Payload verification for --verify.  File contents are hashed as
+ * they pass through the payload writers and compared with the
+ * header's FILEDIGESTS, and the compressed payload is hashed as it is
+ * read and compared with PAYLOADDIGEST, so nothing is read twice.
+ * The header itself is checked against the digest kept for it in the
+ * signature.  SHA-256, the digest of every current package, uses
+ * sha256.c; older algorithms go through librpm.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <rpm/rpmpgp.h>
+#include <rpm/rpmcrypto.h>
+#include <rpm/header.h>
+
+#include "tarpm.h"
+
+void
+digest_init(struct digest *d, const int algo)
+{
+    assert(d != NULL);
+
+    d->algo = algo;
+    d->ctx = NULL;
+
+    if (algo == PGPHASHALGO_SHA256) {
+        sha256_init(&d->sha);
+    } else {
+        d->ctx = rpmDigestInit(algo, RPMDIGEST_NONE);
+    }
+
+    return;
+}
+
+void
+digest_update(struct digest *d, const void *data, const size_t len)
+{
+    assert(d != NULL);
+
+    if (d->algo == PGPHASHALGO_SHA256) {
+        sha256_update(&d->sha, data, len);
+    } else if (d->ctx != NULL) {
+        rpmDigestUpdate(d->ctx, data, len);
+    }
+
+    return;
+}
+
+/*
+ * Finish the digest and store it in out.  Returns the digest length,
+ * or 0 if the algorithm is not supported.
+ */
+size_t
+digest_final(struct digest *d, uint8_t out[DIGEST_MAX_SIZE])
+{
+    void *data = NULL;
+    size_t len = 0;
+
+    assert(d != NULL);
+    assert(out != NULL);
+
+    if (d->algo == PGPHASHALGO_SHA256) {
+        sha256_final(&d->sha, out);
+        return SHA256_DIGEST_SIZE;
+    }
+
+    if (d->ctx == NULL) {
+        return 0;
+    }
+
+    rpmDigestFinal(d->ctx, &data, &len, 0);
+    d->ctx = NULL;
+
+    if (data == NULL || len > DIGEST_MAX_SIZE) {
+        free(data);
+        return 0;
+    }
+
+    memcpy(out, data, len);
+    free(data);
+    return len;
+}
+
+/*
+ * Finish the digest of the payload member at path and compare it with
+ * what the header says.  Returns 0 if they match, -1 otherwise.
+ */
+int
+check_file_digest(const char *path, struct digest *d, const struct filedigest *expect)
+{
+    uint8_t value[DIGEST_MAX_SIZE];
+    size_t len = 0;
+
+    assert(path != NULL);
+    assert(d != NULL);
+    assert(expect != NULL);
+
+    len = digest_final(d, value);
+
+    if (len == 0) {
+        warnx(_("*** %s: unsupported file digest algorithm %d"), path, expect->algo);
+        return -1;
+    }
+
+    if (len != expect->len || memcmp(value, expect->value, len)) {
+        warnx(_("*** %s: file digest mismatch"), path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Write len digest bytes as lowercase hex in to hex. */
+static void
+digest_hex(const uint8_t *value, const size_t len, char *hex)
+{
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        snprintf(hex + (2 * i), 3, "%02x", value[i]);
+    }
+
+    hex[2 * len] = '\0';
+    return;
+}
+
+/*
+ * Find a string tag in the signature section.  Entries were bounds
+ * checked when the section was read, so the string is terminated.
+ */
+static const char *
+signature_string(const struct rpmpkg *pkg, const rpmTagVal tag)
+{
+    uint32_t i = 0;
+    const struct rpmsection *s = &pkg->signature;
+    const struct rpmidxentry *entry = s->svals.estart;
+
+    for (i = 0; i < s->sig.nentries; i++) {
+        if (ntohl(entry[i].tag) == (uint32_t) tag && ntohl(entry[i].type) == RPM_STRING_TYPE) {
+            return (const char *) s->svals.datastart + ntohl(entry[i].offset);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Check the header section against the SHA-256 (or, for old packages,
+ * SHA-1) digest in the signature.  The digest covers the header
+ * intro, index, and data store exactly as they appear in the package.
+ * Returns 0 if it matches or the package has no header digest, -1
+ * otherwise.
+ */
+int
+check_header_digest(const struct rpmpkg *pkg)
+{
+    int algo = PGPHASHALGO_SHA256;
+    const char *expect = NULL;
+    struct digest d;
+    uint8_t value[DIGEST_MAX_SIZE];
+    char hex[(2 * DIGEST_MAX_SIZE) + 1];
+    size_t len = 0;
+
+    assert(pkg != NULL);
+
+    expect = signature_string(pkg, RPMSIGTAG_SHA256);
+
+    if (expect == NULL) {
+        algo = PGPHASHALGO_SHA1;
+        expect = signature_string(pkg, RPMSIGTAG_SHA1);
+    }
+
+    if (expect == NULL) {
+        warnx(_("*** %s: no header digest, header not checked"), pkg->path);
+        return 0;
+    }
+
+    digest_init(&d, algo);
+    digest_update(&d, pkg->view.data + pkg->header.offset, RPMHDRINTROSZ + pkg->header.svals.hlen);
+    len = digest_final(&d, value);
+
+    if (len == 0) {
+        warnx(_("*** %s: unsupported header digest algorithm %d"), pkg->path, algo);
+        return -1;
+    }
+
+    digest_hex(value, len, hex);
+
+    if (strcasecmp(hex, expect)) {
+        warnx(_("*** %s: header digest mismatch"), pkg->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Hash the compressed payload up to offset end in the package. */
+static void
+payload_digest_to(const struct rpmpkg *pkg, struct paydigest *pd, const size_t end)
+{
+    if (end > pd->done && end <= pkg->view.len) {
+        digest_update(&pd->d, pkg->view.data + pd->done, end - pd->done);
+        pd->done = end;
+    }
+
+    return;
+}
+
+/*
+ * Start hashing the compressed payload if the header has a payload
+ * digest.  A mapped package is hashed from the mapping, behind the
+ * payload reader.  Otherwise, as for a pipe, the payload is hashed as
+ * it is read, by the native decoder (see payload_digest_decoder()) or
+ * on its way to rpmio (see payload_digest_fd()).  Call before the
+ * payload is opened.
+ */
+void
+payload_digest_begin(const struct rpmpkg *pkg, struct paydigest *pd)
+{
+    assert(pkg != NULL);
+    assert(pd != NULL);
+
+    memset(pd, 0, sizeof(*pd));
+    pd->expect = headerGetString(pkg->h, RPMTAG_PAYLOADDIGEST);
+
+    if (pd->expect == NULL) {
+        return;
+    }
+
+    digest_init(&pd->d, headerGetNumber(pkg->h, RPMTAG_PAYLOADDIGESTALGO));
+    pd->done = pkg->payload_offset;
+    pd->active = true;
+    pd->stream = !pkg->view.mapped;
+    return;
+}
+
+/* Have the native decoder dec hash the payload as it reads it. */
+void
+payload_digest_decoder(struct paydigest *pd, struct decoder *dec)
+{
+    assert(pd != NULL);
+    assert(dec != NULL);
+
+    if (pd->active && pd->stream) {
+        decoder_digest(dec, &pd->d);
+    }
+
+    return;
+}
+
+/*
+ * Copy the package to the socket rpmio reads the payload from,
+ * hashing it on the way, up to the end of the package.  Once rpmio
+ * stops reading, the rest is only hashed.
+ */
+static void *
+payload_digest_tee(void *arg)
+{
+    struct paydigest *pd = arg;
+    uint8_t buf[IO_BUFFER_MIN];
+    ssize_t n = 0;
+    ssize_t w = 0;
+    size_t off = 0;
+    bool copy = true;
+
+    while ((n = read(pd->in, buf, sizeof(buf))) != 0) {
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1) {
+            warn("read %s", pd->path);
+            pd->failed = true;
+            break;
+        }
+
+        digest_update(&pd->d, buf, n);
+        off = 0;
+
+        while (copy && off < (size_t) n) {
+            w = send(pd->tee[1], buf + off, n - off, MSG_NOSIGNAL);
+
+            if (w == -1 && errno != EINTR) {
+                copy = false;
+            } else if (w > 0) {
+                off += w;
+            }
+        }
+    }
+
+    /* rpmio sees the end of the payload */
+    close(pd->tee[1]);
+    return NULL;
+}
+
+/*
+ * Return the descriptor rpmio should read the payload from.  That is
+ * the package itself unless the payload has to be hashed as it is
+ * read, in which case a thread copies the package to rpmio through a
+ * socket and hashes it.  Returns -1 on error after reporting it.
+ */
+int
+payload_digest_fd(const struct rpmpkg *pkg, struct paydigest *pd)
+{
+    assert(pkg != NULL);
+    assert(pd != NULL);
+
+    if (!pd->active || !pd->stream) {
+        return pkg->fd;
+    }
+
+    /* an unmapped package was read exactly up to the payload */
+    assert(pkg->view.len == (size_t) pkg->payload_offset);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pd->tee) == -1) {
+        warn("socketpair");
+        return -1;
+    }
+
+    pd->in = pkg->fd;
+    pd->path = pkg->path;
+
+    if ((errno = pthread_create(&pd->thread, NULL, payload_digest_tee, pd)) != 0) {
+        err(EXIT_FAILURE, "pthread_create");
+    }
+
+    pd->teeing = true;
+    return pd->tee[0];
+}
+
+/*
+ * Wait for the thread started by payload_digest_fd(), which hashes
+ * the rest of the package once rpmio no longer reads from it.
+ * Returns 0 on success, -1 if the package could not be read.
+ */
+static int
+payload_digest_join(struct paydigest *pd)
+{
+    if (!pd->teeing) {
+        return 0;
+    }
+
+    /* fails the thread's writes, rpmio has read all it needs */
+    shutdown(pd->tee[0], SHUT_RD);
+
+    if ((errno = pthread_join(pd->thread, NULL)) != 0) {
+        warn("pthread_join");
+    }
+
+    close(pd->tee[0]);
+    pd->teeing = false;
+    return pd->failed ? -1 : 0;
+}
+
+/*
+ * Hash the compressed payload up to package offset pos, as far as the
+ * payload reader has got, so it is hashed while it is still cached.
+ */
+void
+payload_digest_update(const struct rpmpkg *pkg, struct paydigest *pd, const size_t pos)
+{
+    if (!pd->active || pd->stream) {
+        return;
+    }
+
+    payload_digest_to(pkg, pd, pos);
+    return;
+}
+
+/*
+ * Hash what is left of a package that is not mapped, which the
+ * decoder has not read, up to the end of the descriptor.  Returns 0
+ * on success, -1 on a read error.
+ */
+static int
+payload_digest_drain(const struct rpmpkg *pkg, struct paydigest *pd)
+{
+    uint8_t buf[IO_BUFFER_MIN];
+    ssize_t n = 0;
+
+    while ((n = read(pkg->fd, buf, sizeof(buf))) != 0) {
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1) {
+            warn("read %s", pkg->path);
+            return -1;
+        }
+
+        digest_update(&pd->d, buf, n);
+    }
+
+    return 0;
+}
+
+/*
+ * Stop hashing without checking anything, when the payload could not
+ * be read.
+ */
+void
+payload_digest_cancel(struct paydigest *pd)
+{
+    uint8_t value[DIGEST_MAX_SIZE];
+
+    if (!pd->active) {
+        return;
+    }
+
+    payload_digest_join(pd);
+    digest_final(&pd->d, value);
+    pd->active = false;
+    return;
+}
+
+/*
+ * Hash the rest of the payload and compare the digest with the
+ * header's PAYLOADDIGEST.  Returns 0 if they match or there is
+ * nothing to check, -1 otherwise.
+ */
+int
+payload_digest_end(const struct rpmpkg *pkg, struct paydigest *pd)
+{
+    uint8_t value[DIGEST_MAX_SIZE];
+    char hex[(2 * DIGEST_MAX_SIZE) + 1];
+    size_t len = 0;
+
+    if (!pd->active) {
+        return 0;
+    }
+
+    pd->active = false;
+
+    if (pd->teeing) {
+        if (payload_digest_join(pd) == -1) {
+            digest_final(&pd->d, value);
+            return -1;
+        }
+    } else if (pd->stream) {
+        if (payload_digest_drain(pkg, pd) == -1) {
+            digest_final(&pd->d, value);
+            return -1;
+        }
+    } else {
+        payload_digest_to(pkg, pd, pkg->view.len);
+    }
+
+    len = digest_final(&pd->d, value);
+
+    if (len == 0) {
+        warnx(_("*** %s: unsupported payload digest algorithm %d"), pkg->path, pd->d.algo);
+        return -1;
+    }
+
+    digest_hex(value, len, hex);
+
+    if (strcasecmp(hex, pd->expect)) {
+        warnx(_("*** %s: payload digest mismatch"), pkg->path);
+        return -1;
+    }
+
+    return 0;
+}
@@ -8,102 +8,70 @@
 #include "tarpm.h"
 
 /*
- * Generate a "signature" or "header" JSON structure for output.
+ * Write the "signature" or "header" section fields as members of the
+ * current JSON object.
  */
-struct json_object *
-generate_json(const struct rpmsignature *sig, const struct rpmsigvalues *svals)
+void
+generate_json(struct jsonw *w, const struct rpmsignature *sig, const struct rpmsigvalues *svals)
 {
-    struct json_object *out = NULL;
-    char *s = NULL;
-
+    assert(w != NULL);
     assert(sig != NULL);
     assert(svals != NULL);
 
-    out = json_object_new_object();
-
-    xasprintf(&s, "0x%X", sig->magic);
-    json_object_object_add(out, RPM_SIGNATURE_MAGIC_DESC, json_object_new_string(s));
-    free(s);
-
-    xasprintf(&s, "%04d", sig->reserved);
-    json_object_object_add(out, RPM_SIGNATURE_RESERVED_DESC, json_object_new_string(s));
-    free(s);
-
-    xasprintf(&s, "%d", sig->nentries);
-    json_object_object_add(out, RPM_SIGNATURE_NENTRIES_DESC, json_object_new_string(s));
-    free(s);
-
-    xasprintf(&s, "%d", svals->ilen);
-    json_object_object_add(out, RPM_SIGNATURE_ILEN_DESC, json_object_new_string(s));
-    free(s);
-
-    xasprintf(&s, "%d", sig->nbytes);
-    json_object_object_add(out, RPM_SIGNATURE_NBYTES_DESC, json_object_new_string(s));
-    free(s);
-
-    xasprintf(&s, "%d", svals->hlen);
-    json_object_object_add(out, RPM_SIGNATURE_HLEN_DESC, json_object_new_string(s));
-    free(s);
+    json_printf(w, RPM_SIGNATURE_MAGIC_DESC, "0x%X", sig->magic);
+    json_printf(w, RPM_SIGNATURE_RESERVED_DESC, "%04d", sig->reserved);
+    json_printf(w, RPM_SIGNATURE_NENTRIES_DESC, "%d", sig->nentries);
+    json_printf(w, RPM_SIGNATURE_ILEN_DESC, "%d", svals->ilen);
+    json_printf(w, RPM_SIGNATURE_NBYTES_DESC, "%d", sig->nbytes);
+    json_printf(w, RPM_SIGNATURE_HLEN_DESC, "%d", svals->hlen);
 
-    return out;
+    return;
 }
 
 /*
- * Generate a "signature" or "header" JSON array of entries for output.
+ * Write the "signature" or "header" entries as a JSON array member of
+ * the current JSON object.  Each entry is written as it is decoded.
  */
-struct json_object *
-generate_json_entries(const struct rpmsignature *sig, const struct rpmsigvalues *svals, struct rpmidxentry *entry, const bool signature)
+void
+generate_json_entries(struct jsonw *w, const struct rpmsignature *sig, const struct rpmsigvalues *svals, const struct rpmidxentry *entry, const bool signature)
 {
     uint32_t i = 0;
     rpmSigTag tag = 0;
     uint32_t offset = 0;
     rpmTagType datatype = 0;
     uint32_t count = 0;
-    struct json_object *jvals = NULL;
-    struct json_object *arrayentry = NULL;
-    char *s = NULL;
+    const char *name = NULL;
 
+    assert(w != NULL);
     assert(sig != NULL);
     assert(svals != NULL);
     assert(entry != NULL);
 
-    jvals = json_object_new_array();
+    json_begin_array(w, RPM_ENTRY_TAGS_DESC);
 
     for (i = 0; i < sig->nentries; i++) {
         tag = ntohl(entry[i].tag);
         offset = ntohl(entry[i].offset);
         datatype = ntohl(entry[i].type);
         count = ntohl(entry[i].count);
-        arrayentry = json_object_new_object();
 
         if (signature) {
-            xasprintf(&s, "%s", signature_tag_name(tag));
+            name = signature_tag_name(tag);
         } else {
-            xasprintf(&s, "%s", rpmTagGetName(tag));
+            name = tag_shortname(tag);
         }
 
-        json_object_object_add(arrayentry, RPM_ENTRY_NAME_DESC, json_object_new_string(s));
-        free(s);
-
-        xasprintf(&s, "%d", tag);
-        json_object_object_add(arrayentry, RPM_ENTRY_TAG_DESC, json_object_new_string(s));
-        free(s);
-
-        xasprintf(&s, "%s", tag_type(datatype));
-        json_object_object_add(arrayentry, RPM_ENTRY_TYPE_DESC, json_object_new_string(s));
-        free(s);
-
-        xasprintf(&s, "0x%X", offset);
-        json_object_object_add(arrayentry, RPM_ENTRY_OFFSET_DESC, json_object_new_string(s));
-        free(s);
-
-        xasprintf(&s, "%d", count);
-        json_object_object_add(arrayentry, RPM_ENTRY_COUNT_DESC, json_object_new_string(s));
-        free(s);
-
-        add_entry_value(arrayentry, svals->datastart, offset, datatype, count);
-        json_object_array_add(jvals, arrayentry);
+        json_begin_object(w, NULL);
+        json_string(w, RPM_ENTRY_NAME_DESC, name);
+        json_printf(w, RPM_ENTRY_TAG_DESC, "%d", tag);
+        json_string(w, RPM_ENTRY_TYPE_DESC, tag_type(datatype));
+        json_printf(w, RPM_ENTRY_OFFSET_DESC, "0x%X", offset);
+        json_printf(w, RPM_ENTRY_COUNT_DESC, "%d", count);
+        add_entry_value(w, svals->datastart, sig->nbytes, offset, datatype, count);
+        json_end_object(w);
     }
 
-    return jvals;
+    json_end_array(w);
+
+    return;
 }
@@ -4,6 +4,8 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <assert.h>
 
 /* Always 0-initialized, unless the compiler disagrees. */
@@ -53,3 +55,159 @@ xreallocarray(void *p, size_t n, size_t s)
     return ret;
 }
 #endif
+
+/*
+ * Arena allocator.  Memory is handed out from large blocks by bumping
+ * a pointer and is only released all at once by arena_reset() or
+ * arena_free().  Use this for the many short lived allocations made
+ * while extracting one part of a package so they cost neither a
+ * malloc() nor a free() each.  Allocations are zero-initialized like
+ * xalloc() and aligned for any type.  An arena is not thread safe.
+ */
+struct arenablock {
+    struct arenablock *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+struct arena {
+    struct arenablock *head;
+    size_t blocksize;
+};
+
+#define ARENA_ALIGN(s) (((s) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+static struct arenablock *
+arena_block(size_t size)
+{
+    struct arenablock *b = NULL;
+
+    b = xcalloc(1, sizeof(*b) + size);
+    b->size = size;
+    return b;
+}
+
+/* Create an arena that allocates blocksize bytes at a time. */
+struct arena *
+arena_new(size_t blocksize)
+{
+    struct arena *a = NULL;
+
+    assert(blocksize > 0);
+
+    a = xalloc(sizeof(*a));
+    a->blocksize = ARENA_ALIGN(blocksize);
+    a->head = arena_block(a->blocksize);
+    return a;
+}
+
+void *
+arena_alloc(struct arena *a, size_t s)
+{
+    struct arenablock *b = NULL;
+    void *ret = NULL;
+
+    assert(a != NULL);
+
+    s = ARENA_ALIGN(s);
+
+    if (a->head->size - a->head->used < s) {
+        /* oversized requests get a block of their own */
+        b = arena_block((s > a->blocksize) ? s : a->blocksize);
+        b->next = a->head;
+        a->head = b;
+    }
+
+    ret = (char *) a->head->data + a->head->used;
+    a->head->used += s;
+    return ret;
+}
+
+/*
+ * Resize an allocation of old bytes to s bytes.  The most recent
+ * allocation grows in place when its block has room; anything else is
+ * copied.  Like xrealloc(NULL, ...), a NULL p just allocates.
+ */
+void *
+arena_realloc(struct arena *a, void *p, size_t old, size_t s)
+{
+    struct arenablock *b = NULL;
+    void *ret = NULL;
+
+    assert(a != NULL);
+
+    if (p == NULL) {
+        return arena_alloc(a, s);
+    }
+
+    b = a->head;
+    old = ARENA_ALIGN(old);
+
+    if ((char *) p + old == (char *) b->data + b->used && b->size - b->used + old >= ARENA_ALIGN(s)) {
+        /* keep everything past used zeroed for later allocations */
+        if (ARENA_ALIGN(s) < old) {
+            memset((char *) p + ARENA_ALIGN(s), 0, old - ARENA_ALIGN(s));
+        }
+
+        b->used += ARENA_ALIGN(s) - old;
+        return p;
+    }
+
+    ret = arena_alloc(a, s);
+    memcpy(ret, p, (old < s) ? old : s);
+    return ret;
+}
+
+char *
+arena_strdup(struct arena *a, const char *s)
+{
+    size_t len = 0;
+
+    assert(s != NULL);
+
+    len = strlen(s) + 1;
+    return memcpy(arena_alloc(a, len), s, len);
+}
+
+/*
+ * Release everything allocated from the arena in one operation.  The
+ * first block is kept and cleared for reuse, so an arena reset between
+ * packages settles at a steady size instead of fragmenting the heap.
+ */
+void
+arena_reset(struct arena *a)
+{
+    struct arenablock *b = NULL;
+
+    assert(a != NULL);
+
+    while (a->head->next != NULL) {
+        b = a->head;
+        a->head = b->next;
+        free(b);
+    }
+
+    memset(a->head->data, 0, a->head->used);
+    a->head->used = 0;
+    return;
+}
+
+void
+arena_free(struct arena *a)
+{
+    struct arenablock *b = NULL;
+
+    if (a == NULL) {
+        return;
+    }
+
+    while (a->head != NULL) {
+        b = a->head;
+        a->head = b->next;
+        free(b);
+    }
+
+    free(a);
+    return;
+}